@@ -0,0 +1,543 @@
+#include "aot.h"
+#include "bf_io.h"
+
+#include <iostream>
+#include <limits>
+#include <stack>
+
+constexpr uint8_t OUT_CUR = offsetof(BfIo, out_cur);
+constexpr uint8_t OUT_END = offsetof(BfIo, out_end);
+constexpr uint8_t IN_CUR = offsetof(BfIo, in_cur);
+constexpr uint8_t IN_END = offsetof(BfIo, in_end);
+constexpr uint8_t FLUSH = offsetof(BfIo, flush);
+constexpr uint8_t READ_BYTE = offsetof(BfIo, read_byte);
+constexpr uint8_t OUT_BEGIN = offsetof(BfIo, out_begin);
+constexpr uint8_t IN_BEGIN = offsetof(BfIo, in_begin);
+constexpr uint8_t OUT_FD = offsetof(BfIo, out_fd);
+constexpr uint8_t IN_FD = offsetof(BfIo, in_fd);
+
+static_assert(offsetof(BfIo, in_fd) < 128, "The AOT runtime addresses BfIo with 8-bit displacements");
+
+// The tape of a standalone executable, with cell 0 in the middle. Pages are
+// only backed once touched.
+constexpr uint64_t AOT_TAPE_SIZE = uint64_t(1) << 32;
+
+constexpr uint8_t RAX = 0;
+constexpr uint8_t RCX = 1;
+
+bool fits_int32(int64_t value) {
+    return value >= std::numeric_limits<int32_t>::min() && value <= std::numeric_limits<int32_t>::max();
+}
+
+// Sign-extends the low cell_width bits of value, which is all a cell keeps.
+int64_t wrap_to_cell(int64_t value, int cell_width) {
+    if (cell_width == 64) {
+        return value;
+    }
+    int shift = 64 - cell_width;
+    return static_cast<int64_t>(static_cast<uint64_t>(value) << shift) >> shift;
+}
+
+int32_t to_int32(int64_t value) {
+    if (!fits_int32(value)) {
+        std::cerr << "Fatal: Offset " << value << " does not fit in 32 bits\n";
+        exit(1);
+    }
+    return static_cast<int32_t>(value);
+}
+
+// Emits "<op> disp(%r13)" on a cell of cell_width bits: the prefixes, the
+// byte or wide form of the opcode and a ModRM byte whose reg field is either
+// a register or an opcode extension. Immediates are up to the caller.
+void emit_cell_insn(CodeEmitter* emitter, int cell_width, uint8_t byte_opcode, uint8_t wide_opcode,
+                    uint8_t reg, int32_t disp) {
+    if (cell_width == 16) {
+        // operand-size prefix
+        emitter->EmitByte(0x66);
+    }
+    // REX.B (+ REX.W for 64-bit cells)
+    emitter->EmitByte(cell_width == 64 ? 0x49 : 0x41);
+    emitter->EmitByte(cell_width == 8 ? byte_opcode : wide_opcode);
+    // mod=10, rm=101: disp32(%r13)
+    emitter->EmitByte(0x85 | (reg << 3));
+    emitter->EmitUint32(disp);
+}
+
+// 64-bit cells take a sign-extended imm32.
+void emit_cell_imm(CodeEmitter* emitter, int cell_width, int64_t value) {
+    if (cell_width == 8) {
+        emitter->EmitByte(value & 0xFF);
+    } else if (cell_width == 16) {
+        emitter->EmitBytes({static_cast<uint8_t>(value & 0xFF), static_cast<uint8_t>((value >> 8) & 0xFF)});
+    } else {
+        emitter->EmitUint32(static_cast<uint32_t>(value));
+    }
+}
+
+// movabs $value, %reg
+void emit_mov_imm64(CodeEmitter* emitter, uint8_t reg, int64_t value) {
+    emitter->EmitBytes({0x48, static_cast<uint8_t>(0xB8 + reg)});
+    emitter->EmitUint64(value);
+}
+
+// add $value, disp(%r13)
+void emit_add_cell(CodeEmitter* emitter, int cell_width, int32_t disp, int64_t value) {
+    value = wrap_to_cell(value, cell_width);
+    if (value == 0) {
+        return;
+    }
+    if (!fits_int32(value)) {
+        emit_mov_imm64(emitter, RAX, value);
+        // add %rax, disp(%r13)
+        emit_cell_insn(emitter, cell_width, 0x00, 0x01, RAX, disp);
+        return;
+    }
+    emit_cell_insn(emitter, cell_width, 0x80, 0x81, 0, disp);
+    emit_cell_imm(emitter, cell_width, value);
+}
+
+// mov $value, disp(%r13)
+void emit_set_cell(CodeEmitter* emitter, int cell_width, int32_t disp, int64_t value) {
+    value = wrap_to_cell(value, cell_width);
+    if (!fits_int32(value)) {
+        emit_mov_imm64(emitter, RAX, value);
+        // mov %rax, disp(%r13)
+        emit_cell_insn(emitter, cell_width, 0x88, 0x89, RAX, disp);
+        return;
+    }
+    emit_cell_insn(emitter, cell_width, 0xC6, 0xC7, 0, disp);
+    emit_cell_imm(emitter, cell_width, value);
+}
+
+// cmp $0, disp(%r13)
+void emit_test_cell(CodeEmitter* emitter, int cell_width, int32_t disp) {
+    emit_cell_insn(emitter, cell_width, 0x80, 0x83, 7, disp);
+    emitter->EmitByte(0x00);
+}
+
+// Loads the cell at disp(%r13) zero-extended into reg.
+void emit_load_cell(CodeEmitter* emitter, int cell_width, uint8_t reg, int32_t disp) {
+    if (cell_width == 8) {
+        // movzbl disp(%r13), reg
+        emitter->EmitBytes({0x41, 0x0F, 0xB6});
+    } else if (cell_width == 16) {
+        // movzwl disp(%r13), reg
+        emitter->EmitBytes({0x41, 0x0F, 0xB7});
+    } else if (cell_width == 32) {
+        // mov disp(%r13), reg (32-bit)
+        emitter->EmitBytes({0x41, 0x8B});
+    } else {
+        // mov disp(%r13), reg (64-bit)
+        emitter->EmitBytes({0x49, 0x8B});
+    }
+    emitter->EmitByte(0x85 | (reg << 3));
+    emitter->EmitUint32(disp);
+}
+
+// Calls io->*fn(io) with the output cursor synced to memory.
+void emit_aot_io_call(CodeEmitter* emitter, uint8_t fn) {
+    // mov %r14, OUT_CUR(%r12)
+    emitter->EmitBytes({0x4D, 0x89, 0x74, 0x24, OUT_CUR});
+    // mov %r12, %rdi
+    emitter->EmitBytes({0x4C, 0x89, 0xE7});
+    // call *fn(%r12)
+    emitter->EmitBytes({0x41, 0xFF, 0x54, 0x24, fn});
+    // mov OUT_CUR(%r12), %r14
+    emitter->EmitBytes({0x4D, 0x8B, 0x74, 0x24, OUT_CUR});
+    // mov OUT_END(%r12), %r15
+    emitter->EmitBytes({0x4D, 0x8B, 0x7C, 0x24, OUT_END});
+}
+
+// Emits a short jump whose target is bound later with bind_jump8, and
+// returns the offset right after it.
+size_t emit_jump8(CodeEmitter* emitter, uint8_t opcode) {
+    emitter->EmitBytes({opcode, 0x00});
+    return emitter->size();
+}
+
+void bind_jump8(CodeEmitter* emitter, size_t jump_from) {
+    emitter->ReplaceByteAtOffset(jump_from - 1, emitter->size() - jump_from);
+}
+
+void emit_jump8_back(CodeEmitter* emitter, uint8_t opcode, size_t target) {
+    emitter->EmitByte(opcode);
+    emitter->EmitByte(static_cast<uint8_t>(target - (emitter->size() + 1)));
+}
+
+void emit_call(CodeEmitter* emitter, size_t target) {
+    emitter->EmitByte(0xE8);
+    emitter->EmitUint32(compute_relative_32bit_offset(emitter->size() + 4, target));
+}
+
+std::vector<uint8_t> compile_bf_run(const std::vector<BfOp>& ops, int cell_width) {
+    return compile_bf_ops(ops, 0, ops.size(), cell_width);
+}
+
+std::vector<uint8_t> compile_bf_ops(const std::vector<BfOp>& ops, size_t begin, size_t end, int cell_width) {
+    int64_t cell_size = cell_width / 8;
+    auto cell_disp = [cell_size](int64_t cell_offset) {
+        return to_int32(cell_offset * cell_size);
+    };
+
+    CodeEmitter emitter;
+
+    std::stack<size_t> open_bracket_stack;
+
+    // Same registers as SimpleJit: %r13 holds the data pointer, %r12 the
+    // BfIo, and %r14/%r15 the output buffer cursor and end. Five pushes keep
+    // the stack 16-byte aligned.
+    //
+    // push %rbx; push %r12; push %r13; push %r14; push %r15
+    emitter.EmitBytes({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+    // mov %rdi, %r13
+    emitter.EmitBytes({0x49, 0x89, 0xFD});
+    // mov %rsi, %r12
+    emitter.EmitBytes({0x49, 0x89, 0xF4});
+    // mov OUT_CUR(%r12), %r14
+    emitter.EmitBytes({0x4D, 0x8B, 0x74, 0x24, OUT_CUR});
+    // mov OUT_END(%r12), %r15
+    emitter.EmitBytes({0x4D, 0x8B, 0x7C, 0x24, OUT_END});
+
+    for (size_t pc = begin; pc < end; pc++) {
+        const BfOp& op = ops[pc];
+        switch (op.kind) {
+            case BfOpKind::INC_PTR:
+            case BfOpKind::DEC_PTR:
+                {
+                    int64_t cells = op.kind == BfOpKind::INC_PTR ? op.argument : -op.argument;
+                    // add $bytes, %r13
+                    emitter.EmitBytes({0x49, 0x81, 0xC5});
+                    emitter.EmitUint32(cell_disp(cells));
+                }
+                break;
+            case BfOpKind::INC_DATA:
+                emit_add_cell(&emitter, cell_width, cell_disp(op.offset), op.argument);
+                break;
+            case BfOpKind::DEC_DATA:
+                emit_add_cell(&emitter, cell_width, cell_disp(op.offset), -op.argument);
+                break;
+            case BfOpKind::READ_STDIN:
+                for (int64_t i = 0; i < op.argument; i++) {
+                    emit_aot_io_call(&emitter, READ_BYTE);
+                    // movzx %al, %eax
+                    emitter.EmitBytes({0x0F, 0xB6, 0xC0});
+                    // mov %rax, disp(%r13) (cell-sized)
+                    emit_cell_insn(&emitter, cell_width, 0x88, 0x89, RAX, cell_disp(op.offset));
+                }
+                break;
+            case BfOpKind::WRITE_STDOUT:
+                for (int64_t i = 0; i < op.argument; i++) {
+                    // mov disp(%r13), %al (the low byte of any cell)
+                    emitter.EmitBytes({0x41, 0x8A, 0x85});
+                    emitter.EmitUint32(cell_disp(op.offset));
+                    // mov %al, (%r14)
+                    emitter.EmitBytes({0x41, 0x88, 0x06});
+                    // inc %r14
+                    emitter.EmitBytes({0x49, 0xFF, 0xC6});
+                    // cmp %r15, %r14
+                    emitter.EmitBytes({0x4D, 0x39, 0xFE});
+                    // jb <past the flush call>
+                    size_t skip_from = emit_jump8(&emitter, 0x72);
+                    emit_aot_io_call(&emitter, FLUSH);
+                    bind_jump8(&emitter, skip_from);
+                }
+                break;
+            case BfOpKind::LOOP_SET_TO_ZERO:
+                emit_set_cell(&emitter, cell_width, cell_disp(op.offset), 0);
+                break;
+            case BfOpKind::SET_DATA:
+                emit_set_cell(&emitter, cell_width, cell_disp(op.offset), op.argument);
+                break;
+            case BfOpKind::LOOP_MOVE_PTR:
+                {
+                    // jmp <test>
+                    size_t test_from = emit_jump8(&emitter, 0xEB);
+                    size_t body = emitter.size();
+                    // add $stride, %r13
+                    emitter.EmitBytes({0x49, 0x81, 0xC5});
+                    emitter.EmitUint32(cell_disp(op.argument));
+                    bind_jump8(&emitter, test_from);
+                    emit_test_cell(&emitter, cell_width, 0);
+                    // jnz <body>
+                    emit_jump8_back(&emitter, 0x75, body);
+                }
+                break;
+            case BfOpKind::LOOP_MOVE_DATA:
+                {
+                    // Multiplying by a zero control cell adds nothing, so no
+                    // branch is needed around the body.
+                    int32_t control = cell_disp(op.offset);
+                    emit_load_cell(&emitter, cell_width, RAX, control);
+                    for (auto& t : op.targets) {
+                        int32_t target = cell_disp(op.offset + t.offset);
+                        int64_t factor = wrap_to_cell(t.factor, cell_width);
+                        if (factor == 1) {
+                            // add %rax, target(%r13)
+                            emit_cell_insn(&emitter, cell_width, 0x00, 0x01, RAX, target);
+                            continue;
+                        }
+                        if (factor == -1) {
+                            // sub %rax, target(%r13)
+                            emit_cell_insn(&emitter, cell_width, 0x28, 0x29, RAX, target);
+                            continue;
+                        }
+                        // The low bits of a product only depend on the low
+                        // bits of its factors, so 32-bit multiplies do for
+                        // narrower cells.
+                        if (fits_int32(factor)) {
+                            if (cell_width == 64) {
+                                emitter.EmitByte(0x48);
+                            }
+                            // imul $factor, %eax, %ecx
+                            emitter.EmitBytes({0x69, 0xC8});
+                            emitter.EmitUint32(static_cast<uint32_t>(factor));
+                        } else {
+                            emit_mov_imm64(&emitter, RCX, factor);
+                            // imul %rax, %rcx
+                            emitter.EmitBytes({0x48, 0x0F, 0xAF, 0xC8});
+                        }
+                        // add %rcx, target(%r13)
+                        emit_cell_insn(&emitter, cell_width, 0x00, 0x01, RCX, target);
+                    }
+                    emit_set_cell(&emitter, cell_width, control, 0);
+                }
+                break;
+            case BfOpKind::JUMP_IF_DATA_ZERO:
+                emit_test_cell(&emitter, cell_width, 0);
+                open_bracket_stack.push(emitter.size());
+                // jz <place holder 0>
+                emitter.EmitBytes({0x0F, 0x84});
+                emitter.EmitUint32(0);
+                break;
+            case BfOpKind::JUMP_IF_DATA_NOT_ZERO:
+                {
+                    if (open_bracket_stack.empty()) {
+                        std::cerr << "Unmatched closing ']' at pc=" << pc;
+                        exit(1);
+                    }
+                    size_t loop_start = open_bracket_stack.top();
+                    open_bracket_stack.pop();
+
+                    emit_test_cell(&emitter, cell_width, 0);
+                    size_t jump_back_from = emitter.size() + 6;
+                    size_t jump_back_to = loop_start + 6;
+                    // jnz <loop body>
+                    emitter.EmitBytes({0x0F, 0x85});
+                    emitter.EmitUint32(compute_relative_32bit_offset(jump_back_from, jump_back_to));
+
+                    size_t jump_forward_from = loop_start + 6;
+                    emitter.ReplaceUint32AtOffset(loop_start + 2,
+                            compute_relative_32bit_offset(jump_forward_from, emitter.size()));
+                }
+                break;
+            case BfOpKind::INVALID_OP:
+            default:
+                std::cerr << "Fatal: Unknown op at pc=" << pc << "(" << get_kind_str(op.kind) << ")";
+                exit(1);
+        }
+    }
+
+    if (!open_bracket_stack.empty()) {
+        std::cerr << "Unmatched opening '[' in ops " << begin << ".." << end;
+        exit(1);
+    }
+
+    // mov %r14, OUT_CUR(%r12)
+    emitter.EmitBytes({0x4D, 0x89, 0x74, 0x24, OUT_CUR});
+    // mov %r13, %rax
+    emitter.EmitBytes({0x4C, 0x89, 0xE8});
+    // pop %r15; pop %r14; pop %r13; pop %r12; pop %rbx
+    emitter.EmitBytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B});
+    // ret
+    emitter.EmitByte(0xC3);
+
+    return emitter.code();
+}
+
+size_t emit_flush_stub(CodeEmitter* emitter) {
+    size_t start = emitter->size();
+
+    // mov %rdi, %r8
+    emitter->EmitBytes({0x49, 0x89, 0xF8});
+    // mov OUT_BEGIN(%r8), %rsi
+    emitter->EmitBytes({0x49, 0x8B, 0x70, OUT_BEGIN});
+    // mov OUT_CUR(%r8), %rdx
+    emitter->EmitBytes({0x49, 0x8B, 0x50, OUT_CUR});
+    // sub %rsi, %rdx
+    emitter->EmitBytes({0x48, 0x29, 0xF2});
+
+    size_t loop = emitter->size();
+    // test %rdx, %rdx
+    emitter->EmitBytes({0x48, 0x85, 0xD2});
+    // jle <done>
+    size_t done_from = emit_jump8(emitter, 0x7E);
+    // mov $1, %eax (write)
+    emitter->EmitBytes({0xB8, 0x01, 0x00, 0x00, 0x00});
+    // mov OUT_FD(%r8), %edi
+    emitter->EmitBytes({0x41, 0x8B, 0x78, OUT_FD});
+    // syscall
+    emitter->EmitBytes({0x0F, 0x05});
+    // cmp $-EINTR, %rax
+    emitter->EmitBytes({0x48, 0x83, 0xF8, 0xFC});
+    // je <loop>
+    emit_jump8_back(emitter, 0x74, loop);
+    // test %rax, %rax
+    emitter->EmitBytes({0x48, 0x85, 0xC0});
+    // js <fail>
+    size_t fail_from = emit_jump8(emitter, 0x78);
+    // add %rax, %rsi
+    emitter->EmitBytes({0x48, 0x01, 0xC6});
+    // sub %rax, %rdx
+    emitter->EmitBytes({0x48, 0x29, 0xC2});
+    // jmp <loop>
+    emit_jump8_back(emitter, 0xEB, loop);
+
+    bind_jump8(emitter, done_from);
+    // mov OUT_BEGIN(%r8), %rax
+    emitter->EmitBytes({0x49, 0x8B, 0x40, OUT_BEGIN});
+    // mov %rax, OUT_CUR(%r8)
+    emitter->EmitBytes({0x49, 0x89, 0x40, OUT_CUR});
+    // ret
+    emitter->EmitByte(0xC3);
+
+    bind_jump8(emitter, fail_from);
+    // mov $1, %edi
+    emitter->EmitBytes({0xBF, 0x01, 0x00, 0x00, 0x00});
+    // mov $231, %eax (exit_group)
+    emitter->EmitBytes({0xB8, 0xE7, 0x00, 0x00, 0x00});
+    // syscall
+    emitter->EmitBytes({0x0F, 0x05});
+
+    return start;
+}
+
+size_t emit_read_byte_stub(CodeEmitter* emitter, size_t flush) {
+    size_t start = emitter->size();
+
+    // mov %rdi, %r8
+    emitter->EmitBytes({0x49, 0x89, 0xF8});
+    // mov IN_CUR(%r8), %rax
+    emitter->EmitBytes({0x49, 0x8B, 0x40, IN_CUR});
+    // cmp IN_END(%r8), %rax
+    emitter->EmitBytes({0x49, 0x3B, 0x40, IN_END});
+    // jne <have>
+    size_t have_from = emit_jump8(emitter, 0x75);
+
+    // Whoever provides the input may be waiting for the output so far (e.g.
+    // a prompt), so flush before blocking.
+    //
+    // push %r8 (also aligns the stack for the call)
+    emitter->EmitBytes({0x41, 0x50});
+    emit_call(emitter, flush);
+    // pop %r8
+    emitter->EmitBytes({0x41, 0x58});
+
+    size_t retry = emitter->size();
+    // xor %eax, %eax (read)
+    emitter->EmitBytes({0x31, 0xC0});
+    // mov IN_FD(%r8), %edi
+    emitter->EmitBytes({0x41, 0x8B, 0x78, IN_FD});
+    // mov IN_BEGIN(%r8), %rsi
+    emitter->EmitBytes({0x49, 0x8B, 0x70, IN_BEGIN});
+    // mov $AOT_IO_BUFFER_SIZE, %edx
+    emitter->EmitByte(0xBA);
+    emitter->EmitUint32(AOT_IO_BUFFER_SIZE);
+    // syscall
+    emitter->EmitBytes({0x0F, 0x05});
+    // cmp $-EINTR, %rax
+    emitter->EmitBytes({0x48, 0x83, 0xF8, 0xFC});
+    // je <retry>
+    emit_jump8_back(emitter, 0x74, retry);
+    // test %rax, %rax
+    emitter->EmitBytes({0x48, 0x85, 0xC0});
+    // jle <eof>
+    size_t eof_from = emit_jump8(emitter, 0x7E);
+    // mov IN_BEGIN(%r8), %rsi
+    emitter->EmitBytes({0x49, 0x8B, 0x70, IN_BEGIN});
+    // add %rsi, %rax
+    emitter->EmitBytes({0x48, 0x01, 0xF0});
+    // mov %rax, IN_END(%r8)
+    emitter->EmitBytes({0x49, 0x89, 0x40, IN_END});
+    // mov %rsi, %rax
+    emitter->EmitBytes({0x48, 0x89, 0xF0});
+
+    bind_jump8(emitter, have_from);
+    // lea 1(%rax), %rcx
+    emitter->EmitBytes({0x48, 0x8D, 0x48, 0x01});
+    // mov %rcx, IN_CUR(%r8)
+    emitter->EmitBytes({0x49, 0x89, 0x48, IN_CUR});
+    // movzbl (%rax), %eax
+    emitter->EmitBytes({0x0F, 0xB6, 0x00});
+    // ret
+    emitter->EmitByte(0xC3);
+
+    bind_jump8(emitter, eof_from);
+    // mov $0xFF, %eax
+    emitter->EmitBytes({0xB8, 0xFF, 0x00, 0x00, 0x00});
+    // ret
+    emitter->EmitByte(0xC3);
+
+    return start;
+}
+
+size_t emit_start_stub(CodeEmitter* emitter, size_t bf_run, size_t flush, size_t* io_address_fixup) {
+    size_t start = emitter->size();
+
+    // mov $io, %ebx
+    emitter->EmitByte(0xBB);
+    *io_address_fixup = emitter->size();
+    emitter->EmitUint32(0);
+
+    // mmap(NULL, AOT_TAPE_SIZE, PROT_READ | PROT_WRITE,
+    //      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)
+    //
+    // mov $9, %eax
+    emitter->EmitBytes({0xB8, 0x09, 0x00, 0x00, 0x00});
+    // xor %edi, %edi
+    emitter->EmitBytes({0x31, 0xFF});
+    // movabs $AOT_TAPE_SIZE, %rsi
+    emitter->EmitBytes({0x48, 0xBE});
+    emitter->EmitUint64(AOT_TAPE_SIZE);
+    // mov $3, %edx
+    emitter->EmitBytes({0xBA, 0x03, 0x00, 0x00, 0x00});
+    // mov $0x4022, %r10d
+    emitter->EmitBytes({0x41, 0xBA, 0x22, 0x40, 0x00, 0x00});
+    // mov $-1, %r8
+    emitter->EmitBytes({0x49, 0xC7, 0xC0, 0xFF, 0xFF, 0xFF, 0xFF});
+    // xor %r9d, %r9d
+    emitter->EmitBytes({0x45, 0x31, 0xC9});
+    // syscall
+    emitter->EmitBytes({0x0F, 0x05});
+    // cmp $-4095, %rax
+    emitter->EmitBytes({0x48, 0x3D, 0x01, 0xF0, 0xFF, 0xFF});
+    // jae <fail>
+    size_t fail_from = emit_jump8(emitter, 0x73);
+
+    // movabs $(AOT_TAPE_SIZE / 2), %rdi
+    emitter->EmitBytes({0x48, 0xBF});
+    emitter->EmitUint64(AOT_TAPE_SIZE / 2);
+    // add %rax, %rdi
+    emitter->EmitBytes({0x48, 0x01, 0xC7});
+    // mov %rbx, %rsi
+    emitter->EmitBytes({0x48, 0x89, 0xDE});
+    emit_call(emitter, bf_run);
+    // mov %rbx, %rdi
+    emitter->EmitBytes({0x48, 0x89, 0xDF});
+    emit_call(emitter, flush);
+    // xor %edi, %edi
+    emitter->EmitBytes({0x31, 0xFF});
+
+    size_t exit = emitter->size();
+    // mov $231, %eax (exit_group)
+    emitter->EmitBytes({0xB8, 0xE7, 0x00, 0x00, 0x00});
+    // syscall
+    emitter->EmitBytes({0x0F, 0x05});
+
+    bind_jump8(emitter, fail_from);
+    // mov $1, %edi
+    emitter->EmitBytes({0xBF, 0x01, 0x00, 0x00, 0x00});
+    // jmp <exit>
+    emit_jump8_back(emitter, 0xEB, exit);
+
+    return start;
+}
@@ -0,0 +1,42 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include "ir.h"
+#include "jit_utils.h"
+
+#include <string>
+#include <vector>
+
+// Size of each of the input and output buffers of a standalone executable.
+constexpr size_t AOT_IO_BUFFER_SIZE = 1 << 16;
+
+// Ahead-of-time compilation of the optimized IR to x86-64 code that runs
+// without this project (see bf_aot).
+//
+// The compiled program is void bf_run(uint8_t* tape, BfIo* io), where tape
+// points at cell 0 and io is laid out as in bf_io.h. Like the JIT backends it
+// only reaches the outside world through io->flush and io->read_byte, so the
+// code is position independent and needs no relocations.
+std::vector<uint8_t> compile_bf_run(const std::vector<BfOp>& ops, int cell_width);
+
+// Compiles ops[begin, end), which must not contain unmatched brackets, to
+// uint8_t* fn(uint8_t* dataptr, BfIo* io) that returns the data pointer it
+// ends with. Used by the tiered interpreter to compile single loops.
+std::vector<uint8_t> compile_bf_ops(const std::vector<BfOp>& ops, size_t begin, size_t end, int cell_width);
+
+// The runtime of a standalone executable, emitted into the same code as
+// bf_run. flush and read_byte use raw syscalls on io->out_fd/io->in_fd.
+// All three return the offset they were emitted at.
+size_t emit_flush_stub(CodeEmitter* emitter);
+size_t emit_read_byte_stub(CodeEmitter* emitter, size_t flush);
+// _start maps a tape, runs bf_run on the BfIo whose address is stored as an
+// imm32 at *io_address_fixup, flushes and exits.
+size_t emit_start_stub(CodeEmitter* emitter, size_t bf_run, size_t flush, size_t* io_address_fixup);
+
+// Writes a static ELF executable that runs the program on stdin/stdout.
+void write_aot_executable(const std::vector<uint8_t>& bf_run, const std::string& path);
+
+// Writes an ELF shared object exporting bf_run.
+void write_aot_shared_object(const std::vector<uint8_t>& bf_run, const std::string& path);
+
+#endif
@@ -0,0 +1,253 @@
+#include "aot.h"
+#include "bf_io.h"
+
+#include <cstring>
+#include <elf.h>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+
+// Executables are linked at a fixed address so _start can refer to the BfIo
+// with an absolute imm32.
+constexpr uint64_t AOT_EXECUTABLE_BASE = 0x400000;
+constexpr uint64_t AOT_PAGE_SIZE = 0x1000;
+
+uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// Pads code with int3.
+void align_code(CodeEmitter* emitter, size_t alignment) {
+    while (emitter->size() % alignment != 0) {
+        emitter->EmitByte(0xCC);
+    }
+}
+
+template <typename T>
+void put_at(std::vector<uint8_t>* image, uint64_t offset, const T& value) {
+    if (image->size() < offset + sizeof(T)) {
+        image->resize(offset + sizeof(T));
+    }
+    memcpy(image->data() + offset, &value, sizeof(T));
+}
+
+void put_bytes_at(std::vector<uint8_t>* image, uint64_t offset, const std::vector<uint8_t>& bytes) {
+    if (image->size() < offset + bytes.size()) {
+        image->resize(offset + bytes.size());
+    }
+    std::copy(bytes.begin(), bytes.end(), image->begin() + offset);
+}
+
+Elf64_Ehdr make_elf_header(uint16_t type, uint64_t entry, uint16_t phnum) {
+    Elf64_Ehdr ehdr;
+    memset(&ehdr, 0, sizeof(ehdr));
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr.e_type = type;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_entry = entry;
+    ehdr.e_phoff = sizeof(Elf64_Ehdr);
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_phentsize = sizeof(Elf64_Phdr);
+    ehdr.e_phnum = phnum;
+    ehdr.e_shentsize = sizeof(Elf64_Shdr);
+    return ehdr;
+}
+
+Elf64_Phdr make_program_header(uint32_t type, uint32_t flags, uint64_t offset, uint64_t addr,
+                               uint64_t file_size, uint64_t mem_size, uint64_t align) {
+    Elf64_Phdr phdr;
+    memset(&phdr, 0, sizeof(phdr));
+    phdr.p_type = type;
+    phdr.p_flags = flags;
+    phdr.p_offset = offset;
+    phdr.p_vaddr = addr;
+    phdr.p_paddr = addr;
+    phdr.p_filesz = file_size;
+    phdr.p_memsz = mem_size;
+    phdr.p_align = align;
+    return phdr;
+}
+
+// Keeps the stack non-executable.
+Elf64_Phdr make_gnu_stack_header() {
+    return make_program_header(PT_GNU_STACK, PF_R | PF_W, 0, 0, 0, 0, 16);
+}
+
+void write_image(const std::vector<uint8_t>& image, const std::string& path, mode_t mode) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Fatal: Unable to write " << path << std::endl;
+        exit(1);
+    }
+    out.write(reinterpret_cast<const char*>(image.data()), image.size());
+    out.close();
+    if (!out || chmod(path.c_str(), mode) != 0) {
+        std::cerr << "Fatal: Unable to write " << path << std::endl;
+        exit(1);
+    }
+}
+
+// Layout: one read/execute segment with the headers, the runtime, bf_run and
+// _start, then a read/write segment with an initialized BfIo followed by
+// the I/O buffers as bss.
+void write_aot_executable(const std::vector<uint8_t>& bf_run, const std::string& path) {
+    const uint16_t phnum = 3;
+    uint64_t text_offset = align_up(sizeof(Elf64_Ehdr) + phnum * sizeof(Elf64_Phdr), 16);
+    uint64_t text_addr = AOT_EXECUTABLE_BASE + text_offset;
+
+    CodeEmitter text;
+    size_t flush = emit_flush_stub(&text);
+    size_t read_byte = emit_read_byte_stub(&text, flush);
+    align_code(&text, 16);
+    size_t run = text.size();
+    for (uint8_t b : bf_run) {
+        text.EmitByte(b);
+    }
+    align_code(&text, 16);
+    size_t io_address_fixup;
+    size_t start = emit_start_stub(&text, run, flush, &io_address_fixup);
+
+    uint64_t text_end = text_offset + text.size();
+    uint64_t data_offset = align_up(text_end, AOT_PAGE_SIZE);
+    uint64_t io_addr = AOT_EXECUTABLE_BASE + data_offset;
+    uint64_t out_buffer_addr = io_addr + align_up(sizeof(BfIo), 64);
+    uint64_t in_buffer_addr = out_buffer_addr + AOT_IO_BUFFER_SIZE;
+    uint64_t data_mem_size = in_buffer_addr + AOT_IO_BUFFER_SIZE - io_addr;
+    text.ReplaceUint32AtOffset(io_address_fixup, static_cast<uint32_t>(io_addr));
+
+    BfIo io;
+    memset(&io, 0, sizeof(io));
+    io.out_begin = reinterpret_cast<uint8_t*>(out_buffer_addr);
+    io.out_cur = io.out_begin;
+    io.out_end = io.out_begin + AOT_IO_BUFFER_SIZE;
+    io.in_begin = reinterpret_cast<uint8_t*>(in_buffer_addr);
+    io.in_cur = io.in_begin;
+    io.in_end = io.in_begin;
+    io.flush = reinterpret_cast<void (*)(BfIo*)>(text_addr + flush);
+    io.read_byte = reinterpret_cast<uint8_t (*)(BfIo*)>(text_addr + read_byte);
+    io.out_fd = 1;
+    io.in_fd = 0;
+
+    std::vector<uint8_t> image;
+    put_at(&image, 0, make_elf_header(ET_EXEC, text_addr + start, phnum));
+    put_at(&image, sizeof(Elf64_Ehdr),
+           make_program_header(PT_LOAD, PF_R | PF_X, 0, AOT_EXECUTABLE_BASE, text_end, text_end, AOT_PAGE_SIZE));
+    put_at(&image, sizeof(Elf64_Ehdr) + sizeof(Elf64_Phdr),
+           make_program_header(PT_LOAD, PF_R | PF_W, data_offset, io_addr, sizeof(BfIo), data_mem_size,
+                               AOT_PAGE_SIZE));
+    put_at(&image, sizeof(Elf64_Ehdr) + 2 * sizeof(Elf64_Phdr), make_gnu_stack_header());
+    put_bytes_at(&image, text_offset, text.code());
+    put_at(&image, data_offset, io);
+
+    write_image(image, path, 0755);
+}
+
+// Layout: the headers, .hash, .dynsym, .dynstr and .text in a read/execute
+// segment, .dynamic in a read/write one (the dynamic loader may write to
+// it), then the section headers so that linkers accept the file too.
+void write_aot_shared_object(const std::vector<uint8_t>& bf_run, const std::string& path) {
+    const uint16_t phnum = 4;
+    const char dynstr[] = "\0bf_run";
+    const char shstrtab[] = "\0.hash\0.dynsym\0.dynstr\0.text\0.dynamic\0.shstrtab";
+    // Offsets of the names in shstrtab.
+    enum : uint32_t { HASH_NAME = 1, DYNSYM_NAME = 7, DYNSTR_NAME = 15, TEXT_NAME = 23, DYNAMIC_NAME = 29,
+                      SHSTRTAB_NAME = 38 };
+    // Section indices.
+    enum : uint16_t { HASH = 1, DYNSYM, DYNSTR, TEXT, DYNAMIC, SHSTRTAB, SECTION_COUNT };
+
+    // A single bucket: lookups walk the chain of both symbols, so the hash
+    // values themselves do not matter.
+    const uint32_t hash[] = {1, 2, 1, 0, 0};
+
+    uint64_t hash_offset = align_up(sizeof(Elf64_Ehdr) + phnum * sizeof(Elf64_Phdr), 8);
+    uint64_t dynsym_offset = align_up(hash_offset + sizeof(hash), 8);
+    uint64_t dynstr_offset = dynsym_offset + 2 * sizeof(Elf64_Sym);
+    uint64_t text_offset = align_up(dynstr_offset + sizeof(dynstr), 16);
+    uint64_t text_end = text_offset + bf_run.size();
+    uint64_t dynamic_offset = align_up(text_end, AOT_PAGE_SIZE);
+    const size_t dynamic_count = 6;
+    uint64_t dynamic_size = dynamic_count * sizeof(Elf64_Dyn);
+    uint64_t shstrtab_offset = dynamic_offset + dynamic_size;
+    uint64_t shdr_offset = align_up(shstrtab_offset + sizeof(shstrtab), 8);
+
+    std::vector<uint8_t> image;
+
+    Elf64_Ehdr ehdr = make_elf_header(ET_DYN, 0, phnum);
+    ehdr.e_shoff = shdr_offset;
+    ehdr.e_shnum = SECTION_COUNT;
+    ehdr.e_shstrndx = SHSTRTAB;
+    put_at(&image, 0, ehdr);
+
+    Elf64_Phdr phdrs[phnum] = {
+        make_program_header(PT_LOAD, PF_R | PF_X, 0, 0, text_end, text_end, AOT_PAGE_SIZE),
+        make_program_header(PT_LOAD, PF_R | PF_W, dynamic_offset, dynamic_offset, dynamic_size, dynamic_size,
+                            AOT_PAGE_SIZE),
+        make_program_header(PT_DYNAMIC, PF_R | PF_W, dynamic_offset, dynamic_offset, dynamic_size, dynamic_size, 8),
+        make_gnu_stack_header(),
+    };
+    for (uint16_t i = 0; i < phnum; i++) {
+        put_at(&image, sizeof(Elf64_Ehdr) + i * sizeof(Elf64_Phdr), phdrs[i]);
+    }
+
+    put_at(&image, hash_offset, hash);
+
+    Elf64_Sym symbols[2];
+    memset(symbols, 0, sizeof(symbols));
+    symbols[1].st_name = 1;
+    symbols[1].st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+    symbols[1].st_other = STV_DEFAULT;
+    symbols[1].st_shndx = TEXT;
+    symbols[1].st_value = text_offset;
+    symbols[1].st_size = bf_run.size();
+    put_at(&image, dynsym_offset, symbols);
+    put_at(&image, dynstr_offset, dynstr);
+    put_bytes_at(&image, text_offset, bf_run);
+
+    Elf64_Dyn dynamic[dynamic_count] = {
+        {DT_HASH, {hash_offset}},
+        {DT_SYMTAB, {dynsym_offset}},
+        {DT_STRTAB, {dynstr_offset}},
+        {DT_STRSZ, {sizeof(dynstr)}},
+        {DT_SYMENT, {sizeof(Elf64_Sym)}},
+        {DT_NULL, {0}},
+    };
+    put_at(&image, dynamic_offset, dynamic);
+    put_at(&image, shstrtab_offset, shstrtab);
+
+    auto section = [](uint32_t name, uint32_t type, uint64_t flags, uint64_t offset, uint64_t size,
+                      uint32_t link, uint32_t info, uint64_t align, uint64_t entry_size) {
+        Elf64_Shdr shdr;
+        shdr.sh_name = name;
+        shdr.sh_type = type;
+        shdr.sh_flags = flags;
+        // Sections are loaded at their file offsets.
+        shdr.sh_addr = flags & SHF_ALLOC ? offset : 0;
+        shdr.sh_offset = offset;
+        shdr.sh_size = size;
+        shdr.sh_link = link;
+        shdr.sh_info = info;
+        shdr.sh_addralign = align;
+        shdr.sh_entsize = entry_size;
+        return shdr;
+    };
+    Elf64_Shdr shdrs[SECTION_COUNT] = {
+        section(0, SHT_NULL, 0, 0, 0, 0, 0, 0, 0),
+        section(HASH_NAME, SHT_HASH, SHF_ALLOC, hash_offset, sizeof(hash), DYNSYM, 0, 8, 4),
+        // info is the index of the first global symbol.
+        section(DYNSYM_NAME, SHT_DYNSYM, SHF_ALLOC, dynsym_offset, sizeof(symbols), DYNSTR, 1, 8,
+                sizeof(Elf64_Sym)),
+        section(DYNSTR_NAME, SHT_STRTAB, SHF_ALLOC, dynstr_offset, sizeof(dynstr), 0, 0, 1, 0),
+        section(TEXT_NAME, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, text_offset, bf_run.size(), 0, 0, 16, 0),
+        section(DYNAMIC_NAME, SHT_DYNAMIC, SHF_ALLOC | SHF_WRITE, dynamic_offset, dynamic_size, DYNSTR, 0, 8,
+                sizeof(Elf64_Dyn)),
+        section(SHSTRTAB_NAME, SHT_STRTAB, 0, shstrtab_offset, sizeof(shstrtab), 0, 0, 1, 0),
+    };
+    put_at(&image, shdr_offset, shdrs);
+
+    write_image(image, path, 0755);
+}
@@ -0,0 +1,64 @@
+// bf_aot: compiles a program ahead of time into a standalone x86-64 Linux
+// executable, or with --shared into a shared object exporting
+// void bf_run(uint8_t* tape, BfIo* io). Neither depends on this project at
+// run time.
+//
+// Usage: bf_aot [--shared] [--cell-width=N] [--verbose] <program.bf> <output>
+
+#include "aot.h"
+#include "passes.h"
+#include "program_loader.h"
+#include "utils.h"
+
+#include <iostream>
+
+int main(int argc, const char** argv) {
+    bool shared = false;
+    bool verbose = false;
+    int cell_width = 8;
+    int arg_i = 1;
+    std::string value;
+    for (; arg_i < argc && std::string(argv[arg_i]).compare(0, 2, "--") == 0; arg_i++) {
+        std::string arg = argv[arg_i];
+        if (arg == "--shared") {
+            shared = true;
+        } else if (arg == "--verbose") {
+            verbose = true;
+        } else if (match_flag_value(arg, "--cell-width", &value)) {
+            cell_width = std::atoi(value.c_str());
+            if (cell_width != 8 && cell_width != 16 && cell_width != 32 && cell_width != 64) {
+                std::cerr << "Fatal: --cell-width must be 8, 16, 32 or 64" << std::endl;
+                exit(1);
+            }
+        } else {
+            std::cerr << "Unknown flag " << arg << std::endl;
+            exit(1);
+        }
+    }
+
+    if (argc - arg_i != 2) {
+        std::cerr << "Usage: " << argv[0] << " [--shared] [--cell-width=N] [--verbose] <program.bf> <output>\n";
+        exit(1);
+    }
+    std::string bf_file_path = argv[arg_i];
+    std::string output_path = argv[arg_i + 1];
+
+    Program program = load_program(bf_file_path);
+
+    Timer t;
+    PassManager pm = create_optimizing_pass_manager();
+    std::vector<BfOp> ops = pm.run(program, verbose);
+    std::vector<uint8_t> code = compile_bf_run(ops, cell_width);
+
+    if (shared) {
+        write_aot_shared_object(code, output_path);
+    } else {
+        write_aot_executable(code, output_path);
+    }
+
+    if (verbose) {
+        std::cout << "Compiled " << ops.size() << " ops into " << code.size() << " bytes of code in "
+                  << t.elapsed() << "s\n";
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef ASMJIT_UTILS_H
+#define ASMJIT_UTILS_H
+
+#include "asmjit/asmjit.h"
+
+#include <cstdint>
+
+// The part of reg that holds a cell of cell_size bytes.
+inline asmjit::X86Gp cell_reg(const asmjit::X86Gp& reg, uint32_t cell_size) {
+    switch (cell_size) {
+        case 1:
+            return reg.r8();
+        case 2:
+            return reg.r16();
+        case 4:
+            return reg.r32();
+        default:
+            return reg.r64();
+    }
+}
+
+// Loads a cell into reg, zero-extended to the full register.
+inline void load_cell(asmjit::X86Assembler& assm, const asmjit::X86Gp& reg, const asmjit::Operand& cell,
+                      uint32_t cell_size) {
+    if (cell_size < 4) {
+        assm.emit(asmjit::X86Inst::kIdMovzx, reg.r32(), cell);
+    } else {
+        assm.emit(asmjit::X86Inst::kIdMov, cell_reg(reg, cell_size), cell);
+    }
+}
+
+#endif
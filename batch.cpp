@@ -0,0 +1,109 @@
+#include "batch.h"
+#include "bf_io.h"
+#include "tape.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+// Each worker holds a tape for the whole batch, and only so many tapes can
+// be active at once.
+constexpr size_t BATCH_MAX_JOBS = 128;
+
+struct BatchQueue {
+    std::mutex mutex;
+    std::deque<size_t> inputs;
+};
+
+// The owner takes from the front, thieves from the back.
+bool take_input(std::vector<BatchQueue>& queues, size_t worker, size_t* input) {
+    for (size_t i = 0; i < queues.size(); i++) {
+        BatchQueue& queue = queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.inputs.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            *input = queue.inputs.front();
+            queue.inputs.pop_front();
+        } else {
+            *input = queue.inputs.back();
+            queue.inputs.pop_back();
+        }
+        return true;
+    }
+    return false;
+}
+
+std::vector<uint8_t> read_input_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Fatal: Unable to open file " << path << std::endl;
+        exit(1);
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+void write_output_file(const std::string& path, const std::vector<uint8_t>& output) {
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(output.data()), output.size());
+    file.close();
+    if (!file) {
+        std::cerr << "Fatal: Unable to write " << path << std::endl;
+        exit(1);
+    }
+}
+
+void run_batch(const Executor& executor, const Program& p, const std::vector<std::string>& inputs,
+               size_t jobs, bool verbose) {
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    jobs = std::min({jobs, inputs.size(), BATCH_MAX_JOBS});
+
+    std::vector<BatchQueue> queues(jobs);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        queues[i % jobs].inputs.push_back(i);
+    }
+
+    std::mutex log_mutex;
+    auto worker = [&](size_t id) {
+        Tape tape;
+        bool dirty = false;
+        size_t input;
+        while (take_input(queues, id, &input)) {
+            if (dirty) {
+                tape.clear();
+            }
+            dirty = true;
+
+            Timer t;
+            MemoryIo io(read_input_file(inputs[input]));
+            executor.execute_on(p, tape.origin(), io.io());
+            write_output_file(inputs[input] + ".out", io.output());
+
+            if (verbose) {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cout << "[worker " << id << "] " << inputs[input] << ": " << t.elapsed() << "s\n";
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < jobs; i++) {
+        threads.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (verbose) {
+        std::cout << "Ran " << inputs.size() << " inputs on " << jobs << " workers\n";
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "executor.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Runs an already compiled program once per input file on jobs worker
+// threads (0 for one per core) and writes each output to <input>.out.
+//
+// Inputs are dealt to per-worker queues up front; a worker that runs out
+// takes work from the other end of another worker's queue, so a few long
+// inputs don't leave the rest of the pool idle. Every worker reuses one tape
+// across its jobs, and the program only ever reads and writes memory, so
+// nothing is shared between jobs except the compiled code.
+void run_batch(const Executor& executor, const Program& p, const std::vector<std::string>& inputs,
+               size_t jobs, bool verbose);
+
+#endif
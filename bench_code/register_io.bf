@@ -0,0 +1,25 @@
+[
+    Echoes each byte of its input hundreds of times from a hot loop that only
+    touches five cells at fixed offsets; compilers that keep those cells in
+    registers have to spill them around every read and output flush in it
+]
+
++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++++++++++++++++++++
+[
+    >,
+    >
+    +++++++++++++++++++++++++++++++++++++++++++++++++++
+    +++++++++++++++++++++++++++++++++++++++++++++++++++
+    +++++++++++++++++++++++++++++++++++++++++++++++++++
+    +++++++++++++++++++++++++++++++++++++++++++++++++++
+    +++++++++++++++++++++++++++++++++++++++++++++++++++
+    [<..>>>+<<-]
+    >[-]++++++++++.
+    <<<-
+]
+>>>>++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++.
+<[-]++++++++++.
@@ -0,0 +1,348 @@
+// bf_bench: runs every engine over every program in a directory of
+// benchmarks and reports parse, compile and execute times over repeated
+// trials, checking that all engines print the same output.
+//
+// Usage: bf_bench [--engines=a,b,...] [--warmup=N] [--trials=N]
+//                 [--csv=<file>] [--json=<file>]
+//                 [--baseline=<csv>] [--threshold=<percent>] [<bench-dir>]
+//
+// <bench-dir> defaults to bench_code. For each <name>.bf in it,
+// <name>.in, if present, is the program's input. The output of the first
+// engine is the reference for the others. With --baseline, the median total
+// time of every engine/program pair is compared against a CSV written by an
+// earlier --csv run, and bf_bench exits with 1 if any got slower by more than
+// --threshold percent (10 by default) or printed the wrong output.
+
+#include "bf_io.h"
+#include "c_jit.h"
+#include "opt1_interp.h"
+#include "opt2_interp.h"
+#include "opt3_interp.h"
+#include "opt_asmjit.h"
+#include "program_loader.h"
+#include "simple_asmjit.h"
+#include "simple_interp.h"
+#include "simple_jit.h"
+#include "tape.h"
+#include "threaded_interp.h"
+#include "tiered_interp.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+
+struct BenchEngine {
+    std::string name;
+    Executor* (*create)();
+};
+
+const BenchEngine BENCH_ENGINES[] = {
+    {"simple", []() -> Executor* { return new SimpleInterpreter(); }},
+    {"opt1", []() -> Executor* { return new Opt1Interpreter(); }},
+    {"opt2", []() -> Executor* { return new Opt2Interpreter(); }},
+    {"opt3", []() -> Executor* { return new Opt3Interpreter(); }},
+    {"threaded", []() -> Executor* { return new ThreadedInterpreter(); }},
+    {"tiered", []() -> Executor* { return new TieredInterpreter(); }},
+    {"simple_jit", []() -> Executor* { return new SimpleJit(); }},
+    {"simple_asmjit", []() -> Executor* { return new SimpleAsmjit(); }},
+    {"opt_asmjit", []() -> Executor* { return new OptAsmjit(); }},
+    {"c_jit", []() -> Executor* { return new CJit(); }},
+};
+
+struct BenchProgram {
+    std::string name;
+    std::string source;
+    std::vector<uint8_t> input;
+};
+
+struct BenchTrial {
+    double parse;
+    double compile;
+    double execute;
+};
+
+struct BenchResult {
+    std::string engine;
+    std::string program;
+    std::vector<BenchTrial> trials;
+    bool output_ok;
+};
+
+std::string read_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Fatal: Unable to open file " << path << std::endl;
+        exit(1);
+    }
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+std::vector<BenchProgram> load_programs(const std::string& dir) {
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) {
+        std::cerr << "Fatal: Unable to open directory " << dir << std::endl;
+        exit(1);
+    }
+    std::vector<std::string> names;
+    while (dirent* entry = readdir(d)) {
+        std::string file = entry->d_name;
+        if (file.size() > 3 && file.compare(file.size() - 3, 3, ".bf") == 0) {
+            names.push_back(file.substr(0, file.size() - 3));
+        }
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+
+    std::vector<BenchProgram> programs;
+    for (auto& name : names) {
+        BenchProgram program;
+        program.name = name;
+        program.source = read_file(dir + "/" + name + ".bf");
+        std::ifstream input(dir + "/" + name + ".in", std::ios::binary);
+        if (input) {
+            program.input.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        }
+        programs.push_back(program);
+    }
+    return programs;
+}
+
+// Runs every phase of one program on a fresh executor.
+BenchTrial run_trial(const BenchEngine& engine, const BenchProgram& program, std::vector<uint8_t>* output) {
+    BenchTrial trial;
+
+    Timer parse_timer;
+    Program p = parse_from_memory(program.source.data(), program.source.size());
+    trial.parse = parse_timer.elapsed();
+
+    std::unique_ptr<Executor> executor(engine.create());
+    executor->set_options(Options());
+    Timer compile_timer;
+    executor->pre_execute_in_parsing_phase(p, false);
+    trial.compile = compile_timer.elapsed();
+
+    Tape tape;
+    MemoryIo io(program.input);
+    Timer execute_timer;
+    executor->execute_on(p, tape.origin(), io.io());
+    trial.execute = execute_timer.elapsed();
+
+    *output = io.output();
+    return trial;
+}
+
+// Nearest-rank percentile.
+double percentile(std::vector<double> values, double p) {
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(std::ceil(p / 100 * values.size()));
+    return values[std::min(std::max<size_t>(rank, 1), values.size()) - 1];
+}
+
+std::vector<double> phase(const BenchResult& r, double BenchTrial::*field) {
+    std::vector<double> values;
+    for (auto& t : r.trials) {
+        values.push_back(t.*field);
+    }
+    return values;
+}
+
+std::vector<double> totals(const BenchResult& r) {
+    std::vector<double> values;
+    for (auto& t : r.trials) {
+        values.push_back(t.parse + t.compile + t.execute);
+    }
+    return values;
+}
+
+const char* CSV_HEADER = "engine,program,trials,parse_median,compile_median,execute_median,"
+                         "execute_min,execute_p10,execute_p90,total_median,output_ok";
+
+void write_csv(const std::string& path, const std::vector<BenchResult>& results) {
+    std::ofstream out(path);
+    out << CSV_HEADER << "\n";
+    for (auto& r : results) {
+        std::vector<double> execute = phase(r, &BenchTrial::execute);
+        out << r.engine << "," << r.program << "," << r.trials.size() << ","
+            << percentile(phase(r, &BenchTrial::parse), 50) << ","
+            << percentile(phase(r, &BenchTrial::compile), 50) << ","
+            << percentile(execute, 50) << "," << percentile(execute, 0) << ","
+            << percentile(execute, 10) << "," << percentile(execute, 90) << ","
+            << percentile(totals(r), 50) << "," << (r.output_ok ? 1 : 0) << "\n";
+    }
+    if (!out) {
+        std::cerr << "Fatal: Unable to write " << path << std::endl;
+        exit(1);
+    }
+}
+
+void write_json(const std::string& path, const std::vector<BenchResult>& results) {
+    std::ofstream out(path);
+    out << "[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << "  {\"engine\": \"" << r.engine << "\", \"program\": \"" << r.program << "\", "
+            << "\"output_ok\": " << (r.output_ok ? "true" : "false") << ", \"trials\": [";
+        for (size_t j = 0; j < r.trials.size(); j++) {
+            const BenchTrial& t = r.trials[j];
+            out << (j ? ", " : "") << "{\"parse\": " << t.parse << ", \"compile\": " << t.compile
+                << ", \"execute\": " << t.execute << "}";
+        }
+        out << "]}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+    if (!out) {
+        std::cerr << "Fatal: Unable to write " << path << std::endl;
+        exit(1);
+    }
+}
+
+// Median total time by "engine,program", from a file written by --csv.
+std::map<std::string, double> read_baseline(const std::string& path) {
+    std::istringstream in(read_file(path));
+    std::map<std::string, double> baseline;
+    std::string line;
+    std::getline(in, line);
+    if (line != CSV_HEADER) {
+        std::cerr << "Fatal: " << path << " is not a bf_bench CSV file" << std::endl;
+        exit(1);
+    }
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields;
+        std::istringstream row(line);
+        for (std::string field; std::getline(row, field, ',');) {
+            fields.push_back(field);
+        }
+        if (fields.size() == 11) {
+            baseline[fields[0] + "," + fields[1]] = std::atof(fields[9].c_str());
+        }
+    }
+    return baseline;
+}
+
+int main(int argc, const char** argv) {
+    std::vector<std::string> engine_names;
+    int warmup = 1;
+    int trials = 5;
+    double threshold = 10;
+    std::string csv_path, json_path, baseline_path;
+    std::string bench_dir = "bench_code";
+
+    std::string value;
+    int arg_i = 1;
+    for (; arg_i < argc && std::string(argv[arg_i]).compare(0, 2, "--") == 0; arg_i++) {
+        std::string arg = argv[arg_i];
+        if (match_flag_value(arg, "--engines", &value)) {
+            std::istringstream list(value);
+            for (std::string name; std::getline(list, name, ',');) {
+                engine_names.push_back(name);
+            }
+        } else if (match_flag_value(arg, "--warmup", &value)) {
+            warmup = std::atoi(value.c_str());
+        } else if (match_flag_value(arg, "--trials", &value)) {
+            trials = std::atoi(value.c_str());
+        } else if (match_flag_value(arg, "--threshold", &value)) {
+            threshold = std::atof(value.c_str());
+        } else if (match_flag_value(arg, "--csv", &csv_path)) {
+        } else if (match_flag_value(arg, "--json", &json_path)) {
+        } else if (match_flag_value(arg, "--baseline", &baseline_path)) {
+        } else {
+            std::cerr << "Unknown flag " << arg << std::endl;
+            exit(1);
+        }
+    }
+    if (arg_i < argc) {
+        bench_dir = argv[arg_i++];
+    }
+    if (arg_i < argc || trials <= 0 || warmup < 0) {
+        std::cerr << "Usage: " << argv[0] << " [--engines=a,b,...] [--warmup=N] [--trials=N] "
+                  << "[--csv=<file>] [--json=<file>] [--baseline=<csv>] [--threshold=<percent>] [<bench-dir>]\n";
+        exit(1);
+    }
+
+    std::vector<const BenchEngine*> engines;
+    for (auto& engine : BENCH_ENGINES) {
+        if (engine_names.empty() ||
+            std::find(engine_names.begin(), engine_names.end(), engine.name) != engine_names.end()) {
+            engines.push_back(&engine);
+        }
+    }
+    if (engines.empty()) {
+        std::cerr << "Fatal: No such engine" << std::endl;
+        exit(1);
+    }
+
+    std::vector<BenchProgram> programs = load_programs(bench_dir);
+    std::vector<BenchResult> results;
+    bool failed = false;
+
+    std::cout << std::left << std::setw(14) << "engine" << std::setw(14) << "program"
+              << std::right << std::setw(10) << "parse" << std::setw(10) << "compile"
+              << std::setw(10) << "execute" << std::setw(10) << "p10" << std::setw(10) << "p90"
+              << "  output\n" << std::fixed << std::setprecision(4);
+
+    for (auto& program : programs) {
+        std::vector<uint8_t> reference;
+        for (size_t e = 0; e < engines.size(); e++) {
+            BenchResult result;
+            result.engine = engines[e]->name;
+            result.program = program.name;
+            result.output_ok = true;
+
+            std::vector<uint8_t> output;
+            for (int i = 0; i < warmup + trials; i++) {
+                BenchTrial trial = run_trial(*engines[e], program, &output);
+                if (e == 0 && i == 0) {
+                    reference = output;
+                }
+                result.output_ok &= output == reference;
+                if (i >= warmup) {
+                    result.trials.push_back(trial);
+                }
+            }
+            failed |= !result.output_ok;
+
+            std::vector<double> execute = phase(result, &BenchTrial::execute);
+            std::cout << std::left << std::setw(14) << result.engine << std::setw(14) << result.program
+                      << std::right << std::setw(10) << percentile(phase(result, &BenchTrial::parse), 50)
+                      << std::setw(10) << percentile(phase(result, &BenchTrial::compile), 50)
+                      << std::setw(10) << percentile(execute, 50) << std::setw(10) << percentile(execute, 10)
+                      << std::setw(10) << percentile(execute, 90)
+                      << (result.output_ok ? "  ok" : "  MISMATCH") << std::endl;
+            results.push_back(result);
+        }
+    }
+
+    if (!csv_path.empty()) {
+        write_csv(csv_path, results);
+    }
+    if (!json_path.empty()) {
+        write_json(json_path, results);
+    }
+
+    if (!baseline_path.empty()) {
+        std::map<std::string, double> baseline = read_baseline(baseline_path);
+        std::cout << "\nTotal time against " << baseline_path << ":\n";
+        for (auto& r : results) {
+            auto it = baseline.find(r.engine + "," + r.program);
+            if (it == baseline.end() || it->second <= 0) {
+                continue;
+            }
+            double change = (percentile(totals(r), 50) / it->second - 1) * 100;
+            bool regressed = change > threshold;
+            failed |= regressed;
+            std::cout << std::left << std::setw(14) << r.engine << std::setw(14) << r.program
+                      << std::right << std::showpos << std::setw(9) << std::setprecision(1) << change
+                      << "%" << std::noshowpos << (regressed ? "  REGRESSION" : "") << std::endl;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
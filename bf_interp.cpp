@@ -1,8 +1,10 @@
 #include "utils.h"
 #include "executor.h"
+#include "batch.h"
+#include "perf_counters.h"
+#include "program_loader.h"
 #include <string>
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <memory>
 
@@ -14,29 +16,20 @@
 #include "opt2_interp.h"
 #elif defined OPT3
 #include "opt3_interp.h"
+#elif defined THREADED
+#include "threaded_interp.h"
 #elif defined SIMPLE_JIT
 #include "simple_jit.h"
 #elif defined SIMPLE_ASMJIT
 #include "simple_asmjit.h"
 #elif defined OPT_ASMJIT
 #include "opt_asmjit.h"
+#elif defined C_JIT
+#include "c_jit.h"
+#elif defined TIERED
+#include "tiered_interp.h"
 #endif
 
-Program parse_from_stream(std::istream& stream) {
-    Program program;
-
-    for (std::string line; std::getline(stream, line);) {
-        for (auto c : line) {
-            if (c == '>' || c == '<' || c == '+' || c == '-' || c == '.' ||
-                c == ',' || c == '[' || c == ']') {
-                program.instructions.push_back(c);
-            }
-        }
-    }
-
-    return program;
-}
-
 Executor* __newExecutorImpl() {
 #ifdef SIMPLE
     return new SimpleInterpreter();
@@ -46,12 +39,18 @@ Executor* __newExecutorImpl() {
     return new Opt2Interpreter();
 #elif defined OPT3
     return new Opt3Interpreter();
+#elif defined THREADED
+    return new ThreadedInterpreter();
 #elif defined SIMPLE_JIT
     return new SimpleJit();
 #elif defined SIMPLE_ASMJIT
     return new SimpleAsmjit();
 #elif defined OPT_ASMJIT
     return new OptAsmjit();
+#elif defined C_JIT
+    return new CJit();
+#elif defined TIERED
+    return new TieredInterpreter();
 #else
     std::cerr << "Cannot Infrate Executor Impl. Don't you forget set correct variable? (e.g. -DSIMPLE)\n";
     abort();
@@ -64,22 +63,24 @@ std::unique_ptr<Executor> newExecutor() {
 }
 
 int main(int argc, const char** argv) {
-    bool verbose = false;
+    Options options;
     std::string bf_file_path;
 
-    parse_command_line(argc, argv, &bf_file_path, &verbose);
+    parse_command_line(argc, argv, &bf_file_path, &options);
+    bool verbose = options.verbose;
 
     std::unique_ptr<Executor> executor = newExecutor();
+    executor->set_options(options);
 
-    std::ifstream file(bf_file_path);
-    if (!file) {
-        std::cerr << "Fatal: Unable to open file " << bf_file_path << std::endl;
-        exit(1);
-    }
+    PerfCounters perf(options.perf_counters);
     Timer t1;
-    Program program = parse_from_stream(file);
+    perf.start();
+    Program program = load_program(bf_file_path);
+    perf.stop("parse");
 
+    perf.start();
     executor->pre_execute_in_parsing_phase(program, verbose);
+    perf.stop("compile");
 
     if (verbose) {
         std::cout << "Parsing took: " << t1.elapsed() << "s\n";
@@ -92,7 +93,14 @@ int main(int argc, const char** argv) {
     }
 
     Timer t2;
-    executor->execute(program, verbose);
+    perf.start();
+    if (options.batch) {
+        run_batch(*executor, program, options.batch_inputs, options.batch_jobs, verbose);
+    } else {
+        executor->execute(program, verbose);
+    }
+    perf.stop("execute");
+    perf.report(std::cerr);
 
     if (verbose) {
         std::cout << "\n[<] Done (elapsed: " << t2.elapsed() << "s)\n";
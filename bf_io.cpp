@@ -0,0 +1,303 @@
+#include "bf_io.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+constexpr size_t IO_BUFFER_SIZE = 1 << 16;
+constexpr size_t ASYNC_RING_SIZE = 1 << 22;
+constexpr int ASYNC_SPIN_COUNT = 1000;
+// How long the reader thread blocks in poll() before checking for shutdown.
+constexpr int ASYNC_POLL_TIMEOUT_MS = 10;
+
+void write_all(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write");
+            exit(1);
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+void flush_fd(BfIo* io) {
+    write_all(io->out_fd, io->out_begin, io->out_cur - io->out_begin);
+    io->out_cur = io->out_begin;
+}
+
+uint8_t read_byte_fd(BfIo* io) {
+    if (io->in_cur == io->in_end) {
+        if (io->interactive) {
+            io->flush(io);
+        }
+
+        ssize_t n;
+        do {
+            n = read(io->in_fd, io->in_begin, IO_BUFFER_SIZE);
+        } while (n < 0 && errno == EINTR);
+
+        if (n <= 0) {
+            return 0xFF;
+        }
+        io->in_cur = io->in_begin;
+        io->in_end = io->in_begin + n;
+    }
+    return *io->in_cur++;
+}
+
+// Single-producer/single-consumer byte ring. head and tail count every byte
+// ever written and consumed, and each is only stored by its own side. The
+// mutex is only taken to sleep and to wake the other side, never to access
+// data.
+struct ByteRing {
+    explicit ByteRing(size_t size) : data(size) {}
+
+    uint8_t* at(uint64_t pos) {
+        return data.data() + pos % data.size();
+    }
+
+    // Contiguous bytes the producer may fill starting at head.
+    size_t writable() const {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        size_t free = data.size() - (h - tail.load(std::memory_order_acquire));
+        return std::min(free, data.size() - h % data.size());
+    }
+
+    // Contiguous bytes the consumer may take starting at tail.
+    size_t readable() const {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        size_t avail = head.load(std::memory_order_acquire) - t;
+        return std::min(avail, data.size() - t % data.size());
+    }
+
+    // Advances head or tail by n and wakes the other side.
+    void publish(std::atomic<uint64_t>* counter, size_t n) {
+        counter->store(counter->load(std::memory_order_relaxed) + n, std::memory_order_release);
+        wake();
+    }
+
+    void close() {
+        closed.store(true);
+        wake();
+    }
+
+    template <typename Ready>
+    void wait(Ready ready) {
+        for (int i = 0; i < ASYNC_SPIN_COUNT; i++) {
+            if (ready()) {
+                return;
+            }
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, ready);
+    }
+
+    void wake() {
+        // Taking the lock orders this wakeup after a waiter's last check of
+        // its condition, so it cannot be lost.
+        { std::lock_guard<std::mutex> lock(mutex); }
+        cv.notify_all();
+    }
+
+    std::vector<uint8_t> data;
+    std::atomic<uint64_t> head{0};
+    // Keeps head and tail on separate cache lines.
+    uint8_t padding[64];
+    std::atomic<uint64_t> tail{0};
+    std::atomic<bool> closed{false};
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+struct AsyncIo {
+    AsyncIo() : out(ASYNC_RING_SIZE), in(ASYNC_RING_SIZE) {}
+
+    ByteRing out;
+    ByteRing in;
+    std::thread writer;
+    // Started on the first read so programs that never read leave stdin alone.
+    std::thread reader;
+};
+
+void drain_output(AsyncIo* async, int fd) {
+    ByteRing& ring = async->out;
+    while (true) {
+        ring.wait([&ring] { return ring.readable() > 0 || ring.closed.load(); });
+        size_t n = ring.readable();
+        if (n == 0) {
+            return;
+        }
+        write_all(fd, ring.at(ring.tail.load(std::memory_order_relaxed)), n);
+        ring.publish(&ring.tail, n);
+    }
+}
+
+void fill_input(AsyncIo* async, int fd) {
+    ByteRing& ring = async->in;
+    while (true) {
+        ring.wait([&ring] { return ring.writable() > 0 || ring.closed.load(); });
+        if (ring.closed.load()) {
+            return;
+        }
+
+        pollfd pfd = {fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, ASYNC_POLL_TIMEOUT_MS);
+        if (ready == 0 || (ready < 0 && errno == EINTR)) {
+            continue;
+        }
+
+        size_t n = std::min(ring.writable(), IO_BUFFER_SIZE);
+        ssize_t got;
+        do {
+            got = read(fd, ring.at(ring.head.load(std::memory_order_relaxed)), n);
+        } while (got < 0 && errno == EINTR);
+
+        if (got <= 0) {
+            ring.close();
+            return;
+        }
+        ring.publish(&ring.head, got);
+    }
+}
+
+// Hands out_begin..out_cur to the writer thread and moves the window to the
+// next free part of the ring.
+void flush_async(BfIo* io) {
+    ByteRing& ring = static_cast<AsyncIo*>(io->context)->out;
+    ring.publish(&ring.head, io->out_cur - io->out_begin);
+    ring.wait([&ring] { return ring.writable() > 0; });
+
+    io->out_begin = ring.at(ring.head.load(std::memory_order_relaxed));
+    io->out_cur = io->out_begin;
+    io->out_end = io->out_begin + std::min(ring.writable(), IO_BUFFER_SIZE);
+}
+
+// Returns the window in_begin..in_end to the reader thread and takes the
+// next one.
+uint8_t read_byte_async(BfIo* io) {
+    if (io->in_cur != io->in_end) {
+        return *io->in_cur++;
+    }
+
+    AsyncIo* async = static_cast<AsyncIo*>(io->context);
+    ByteRing& ring = async->in;
+    if (!async->reader.joinable()) {
+        async->reader = std::thread(fill_input, async, io->in_fd);
+    }
+
+    if (io->in_end != io->in_begin) {
+        ring.publish(&ring.tail, io->in_end - io->in_begin);
+    }
+    if (ring.readable() == 0) {
+        // About to block, so show everything written so far (e.g. a prompt).
+        io->flush(io);
+        ring.wait([&ring] { return ring.readable() > 0 || ring.closed.load(); });
+    }
+
+    io->in_begin = ring.at(ring.tail.load(std::memory_order_relaxed));
+    io->in_cur = io->in_begin;
+    io->in_end = io->in_begin + ring.readable();
+    if (io->in_cur == io->in_end) {
+        return 0xFF;
+    }
+    return *io->in_cur++;
+}
+
+StdIo::StdIo(bool async) {
+    // Anything already written through std::cout (e.g. --verbose output)
+    // must come before the program's output.
+    std::cout.flush();
+
+    io_.out_fd = STDOUT_FILENO;
+    io_.in_fd = STDIN_FILENO;
+    io_.interactive = isatty(STDIN_FILENO);
+
+    if (async) {
+        async_.reset(new AsyncIo());
+        io_.out_begin = async_->out.at(0);
+        io_.out_cur = io_.out_begin;
+        io_.out_end = io_.out_begin + IO_BUFFER_SIZE;
+        io_.in_begin = async_->in.at(0);
+        io_.in_cur = io_.in_begin;
+        io_.in_end = io_.in_begin;
+        io_.flush = flush_async;
+        io_.read_byte = read_byte_async;
+        io_.context = async_.get();
+        async_->writer = std::thread(drain_output, async_.get(), io_.out_fd);
+        return;
+    }
+
+    out_buffer_.resize(IO_BUFFER_SIZE);
+    in_buffer_.resize(IO_BUFFER_SIZE);
+    io_.out_begin = out_buffer_.data();
+    io_.out_cur = io_.out_begin;
+    io_.out_end = io_.out_begin + out_buffer_.size();
+    io_.in_begin = in_buffer_.data();
+    io_.in_cur = io_.in_begin;
+    io_.in_end = io_.in_begin;
+    io_.flush = flush_fd;
+    io_.read_byte = read_byte_fd;
+    io_.context = nullptr;
+}
+
+StdIo::~StdIo() {
+    io_.flush(&io_);
+    if (async_) {
+        async_->out.close();
+        async_->writer.join();
+        async_->in.close();
+        if (async_->reader.joinable()) {
+            async_->reader.join();
+        }
+    }
+}
+
+// Moves the window out_begin..out_cur to the end of MemoryIo's output.
+void flush_memory(BfIo* io) {
+    std::vector<uint8_t>* output = static_cast<std::vector<uint8_t>*>(io->context);
+    output->insert(output->end(), io->out_begin, io->out_cur);
+    io->out_cur = io->out_begin;
+}
+
+// The whole input is in the window from the start, so this is only reached
+// at its end (or from code that always calls read_byte).
+uint8_t read_byte_memory(BfIo* io) {
+    if (io->in_cur == io->in_end) {
+        return 0xFF;
+    }
+    return *io->in_cur++;
+}
+
+MemoryIo::MemoryIo(std::vector<uint8_t> input)
+    : input_(std::move(input)), out_buffer_(IO_BUFFER_SIZE) {
+    io_.out_begin = out_buffer_.data();
+    io_.out_cur = io_.out_begin;
+    io_.out_end = io_.out_begin + out_buffer_.size();
+    io_.in_begin = input_.data();
+    io_.in_cur = io_.in_begin;
+    io_.in_end = io_.in_begin + input_.size();
+    io_.flush = flush_memory;
+    io_.read_byte = read_byte_memory;
+    io_.out_fd = -1;
+    io_.in_fd = -1;
+    io_.interactive = false;
+    io_.context = &output_;
+}
+
+const std::vector<uint8_t>& MemoryIo::output() {
+    io_.flush(&io_);
+    return output_;
+}
@@ -0,0 +1,119 @@
+#ifndef BF_IO_H
+#define BF_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// Buffered program I/O shared by every backend. The layout is fixed because
+// JIT code keeps out_cur/out_end in registers and calls flush/read_byte
+// through this struct; only when the output buffer is full or the input
+// buffer is empty does it leave generated code.
+struct BfIo {
+    uint8_t* out_cur;
+    uint8_t* out_end;
+    uint8_t* in_cur;
+    uint8_t* in_end;
+
+    // Writes out everything before out_cur and resets out_cur/out_end.
+    void (*flush)(BfIo* io);
+    // Returns the next input byte, refilling the input buffer when it is
+    // empty. Returns 0xFF at end of input, like the old cin.get()/getchar().
+    uint8_t (*read_byte)(BfIo* io);
+
+    uint8_t* out_begin;
+    uint8_t* in_begin;
+    int out_fd;
+    int in_fd;
+    // Output is flushed before blocking on input from a terminal.
+    bool interactive;
+    // Backend state for flush/read_byte.
+    void* context;
+};
+
+static_assert(offsetof(BfIo, read_byte) < 128, "JIT code addresses BfIo with 8-bit displacements");
+
+inline void bf_io_put(BfIo* io, uint8_t c) {
+    *io->out_cur++ = c;
+    if (io->out_cur == io->out_end) {
+        io->flush(io);
+    }
+}
+
+// Copies a whole block into the output buffer, flushing as it fills.
+inline void bf_io_write(BfIo* io, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        size_t n = static_cast<size_t>(io->out_end - io->out_cur);
+        if (n > size) {
+            n = size;
+        }
+        memcpy(io->out_cur, data, n);
+        io->out_cur += n;
+        data += n;
+        size -= n;
+        if (io->out_cur == io->out_end) {
+            io->flush(io);
+        }
+    }
+}
+
+inline uint8_t bf_io_get(BfIo* io) {
+    if (io->in_cur != io->in_end) {
+        return *io->in_cur++;
+    }
+    return io->read_byte(io);
+}
+
+struct AsyncIo;
+
+// Owns the buffers of a BfIo bound to stdin/stdout and flushes the output
+// when destroyed.
+//
+// With async, the buffers are windows into two single-producer/single-consumer
+// rings: a writer thread drains output and a reader thread reads input ahead,
+// so the executing thread only blocks when a ring is full or empty.
+class StdIo {
+public:
+    explicit StdIo(bool async = false);
+    ~StdIo();
+
+    StdIo(const StdIo&) = delete;
+    StdIo& operator=(const StdIo&) = delete;
+
+    BfIo* io() {
+        return &io_;
+    }
+
+private:
+    BfIo io_;
+    std::vector<uint8_t> out_buffer_;
+    std::vector<uint8_t> in_buffer_;
+    std::unique_ptr<AsyncIo> async_;
+};
+
+// Owns a BfIo that reads from a byte string and collects the output in
+// memory, for running a program on many inputs at once.
+class MemoryIo {
+public:
+    explicit MemoryIo(std::vector<uint8_t> input);
+
+    MemoryIo(const MemoryIo&) = delete;
+    MemoryIo& operator=(const MemoryIo&) = delete;
+
+    BfIo* io() {
+        return &io_;
+    }
+
+    // Everything written so far.
+    const std::vector<uint8_t>& output();
+
+private:
+    BfIo io_;
+    std::vector<uint8_t> input_;
+    std::vector<uint8_t> out_buffer_;
+    std::vector<uint8_t> output_;
+};
+
+#endif
@@ -0,0 +1,316 @@
+#include "c_jit.h"
+#include "bf_io.h"
+#include "passes.h"
+#include "tape.h"
+#include "utils.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Top-level statements per generated function.
+constexpr size_t C_JIT_CHUNK_STATEMENTS = 64;
+
+// The generated code only sees BfIo through this copy of its declaration.
+const char* C_JIT_PRELUDE = R"(#include <stdint.h>
+
+struct BfIo {
+    uint8_t* out_cur;
+    uint8_t* out_end;
+    uint8_t* in_cur;
+    uint8_t* in_end;
+    void (*flush)(struct BfIo* io);
+    uint8_t (*read_byte)(struct BfIo* io);
+    uint8_t* out_begin;
+    uint8_t* in_begin;
+    int out_fd;
+    int in_fd;
+    _Bool interactive;
+    void* context;
+};
+
+/* The output cursor is kept in locals and written back around calls. */
+#define WRITE(value) do { \
+    *out_cur++ = (uint8_t)(value); \
+    if (out_cur == out_end) { \
+        io->out_cur = out_cur; \
+        io->flush(io); \
+        out_cur = io->out_cur; \
+        out_end = io->out_end; \
+    } \
+} while (0)
+
+#define READ(cell_lvalue) do { \
+    if (io->in_cur != io->in_end) { \
+        (cell_lvalue) = *io->in_cur++; \
+    } else { \
+        io->out_cur = out_cur; \
+        (cell_lvalue) = io->read_byte(io); \
+        out_cur = io->out_cur; \
+        out_end = io->out_end; \
+    } \
+} while (0)
+
+)";
+
+// The prelude's struct has to match BfIo as C lays it out on x86-64.
+static_assert(offsetof(BfIo, out_cur) == 0, "C_JIT_PRELUDE is out of date");
+static_assert(offsetof(BfIo, out_end) == 8, "C_JIT_PRELUDE is out of date");
+static_assert(offsetof(BfIo, in_cur) == 16, "C_JIT_PRELUDE is out of date");
+static_assert(offsetof(BfIo, in_end) == 24, "C_JIT_PRELUDE is out of date");
+static_assert(offsetof(BfIo, flush) == 32, "C_JIT_PRELUDE is out of date");
+static_assert(offsetof(BfIo, read_byte) == 40, "C_JIT_PRELUDE is out of date");
+static_assert(offsetof(BfIo, out_begin) == 48, "C_JIT_PRELUDE is out of date");
+static_assert(offsetof(BfIo, in_begin) == 56, "C_JIT_PRELUDE is out of date");
+static_assert(offsetof(BfIo, out_fd) == 64, "C_JIT_PRELUDE is out of date");
+static_assert(offsetof(BfIo, in_fd) == 68, "C_JIT_PRELUDE is out of date");
+static_assert(offsetof(BfIo, interactive) == 72, "C_JIT_PRELUDE is out of date");
+static_assert(offsetof(BfIo, context) == 80, "C_JIT_PRELUDE is out of date");
+static_assert(sizeof(BfIo) == 88, "C_JIT_PRELUDE is out of date");
+
+namespace {
+
+// Runs args[0] with args, without a shell, and waits for it. Returns whether
+// it exited with status 0.
+bool run_command(const std::vector<std::string>& args) {
+    std::vector<char*> argv;
+    for (auto& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        execvp(argv[0], argv.data());
+        perror(argv[0]);
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            exit(1);
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+}  // namespace
+
+CJit::~CJit() {
+    if (library != nullptr) {
+        dlclose(library);
+    }
+}
+
+void CJit::pre_execute_in_parsing_phase(const Program& p, bool verbose) {
+    PassManager pm = create_optimizing_pass_manager();
+    std::vector<BfOp> ops = pm.run(p, verbose);
+
+    const char* tmp = getenv("TMPDIR");
+    std::string dir_template = std::string(tmp != nullptr ? tmp : "/tmp") + "/bf_c_jit.XXXXXX";
+    if (mkdtemp(&dir_template[0]) == nullptr) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    std::string source_path = dir_template + "/program.c";
+    std::string library_path = dir_template + "/program.so";
+
+    std::ofstream source(source_path);
+    source << emit_c_source(ops);
+    source.close();
+    if (!source) {
+        std::cerr << "Fatal: Unable to write " << source_path << std::endl;
+        exit(1);
+    }
+
+    // $CC may hold arguments of its own, as in CC="ccache cc", so it is split
+    // on whitespace. The paths are passed as they are.
+    const char* cc = getenv("CC");
+    std::istringstream cc_words(cc != nullptr ? cc : "");
+    std::vector<std::string> args;
+    for (std::string word; cc_words >> word;) {
+        args.push_back(word);
+    }
+    if (args.empty()) {
+        args.push_back("cc");
+    }
+    args.insert(args.end(), {"-O3", "-march=native", "-shared", "-fPIC", "-o", library_path, source_path});
+
+    Timer t;
+    bool compiled = run_command(args);
+    if (verbose) {
+        std::cout << "Compiling C took: " << t.elapsed() << "s (";
+        for (size_t i = 0; i < args.size(); i++) {
+            std::cout << (i > 0 ? " " : "") << args[i];
+        }
+        std::cout << ")\n";
+    }
+    if (!compiled) {
+        std::cerr << "Fatal: C compiler failed, keeping " << source_path << std::endl;
+        exit(1);
+    }
+
+    library = dlopen(library_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (library == nullptr) {
+        std::cerr << "Fatal: " << dlerror() << std::endl;
+        exit(1);
+    }
+    bf_run = dlsym(library, "bf_run");
+    if (bf_run == nullptr) {
+        std::cerr << "Fatal: " << dlerror() << std::endl;
+        exit(1);
+    }
+
+    // The mapping stays valid once the files are gone.
+    unlink(library_path.c_str());
+    unlink(source_path.c_str());
+    rmdir(dir_template.c_str());
+}
+
+void CJit::execute(const Program& p, bool verbose) {
+    Tape tape;
+    StdIo stdio(options.async_io);
+    execute_on(p, tape.origin(), stdio.io());
+}
+
+void CJit::execute_on(const Program& p, uint8_t* tape, BfIo* io) const {
+    using CompiledFunc = void (*)(uint8_t*, BfIo*);
+    CompiledFunc func = reinterpret_cast<CompiledFunc>(bf_run);
+    func(tape, io);
+}
+
+// Structured C: brackets become while loops and every op a statement on
+// p[offset], leaving scheduling and register allocation to the compiler.
+//
+// Compile time grows much faster than linearly with the size of a function,
+// so the top level is cut into noinline chunks of about
+// C_JIT_CHUNK_STATEMENTS statements that bf_run calls in turn. Loops are
+// never split.
+std::string CJit::emit_c_source(const std::vector<BfOp>& ops) {
+    int cell_width = options.cell_width;
+    // Constants are emitted modulo the cell size, as unsigned literals.
+    auto constant = [cell_width](int64_t value) {
+        uint64_t bits = static_cast<uint64_t>(value);
+        if (cell_width < 64) {
+            bits &= (uint64_t(1) << cell_width) - 1;
+        }
+        return std::to_string(bits) + (cell_width == 64 ? "ull" : "u");
+    };
+    auto cell = [](int64_t offset) {
+        return "p[" + std::to_string(offset) + "]";
+    };
+
+    std::ostringstream out;
+    out << C_JIT_PRELUDE;
+    out << "typedef uint" << cell_width << "_t cell;\n\n";
+
+    std::ostringstream body;
+    size_t chunk_count = 0;
+    size_t chunk_statements = 0;
+    auto finish_chunk = [&]() {
+        out << "__attribute__((noinline)) static cell* chunk_" << chunk_count
+            << "(cell* p, struct BfIo* io) {\n";
+        out << "    uint8_t* out_cur = io->out_cur;\n";
+        out << "    uint8_t* out_end = io->out_end;\n";
+        out << body.str();
+        out << "    io->out_cur = out_cur;\n";
+        out << "    return p;\n";
+        out << "}\n\n";
+        body.str("");
+        chunk_count++;
+        chunk_statements = 0;
+    };
+
+    std::string indent = "    ";
+    for (size_t pc = 0; pc < ops.size(); pc++) {
+        const BfOp& op = ops[pc];
+        switch (op.kind) {
+            case BfOpKind::INC_PTR:
+                body << indent << "p += " << op.argument << ";\n";
+                break;
+            case BfOpKind::DEC_PTR:
+                body << indent << "p -= " << op.argument << ";\n";
+                break;
+            case BfOpKind::INC_DATA:
+                body << indent << cell(op.offset) << " += " << constant(op.argument) << ";\n";
+                break;
+            case BfOpKind::DEC_DATA:
+                body << indent << cell(op.offset) << " -= " << constant(op.argument) << ";\n";
+                break;
+            case BfOpKind::READ_STDIN:
+                for (int64_t i = 0; i < op.argument; i++) {
+                    body << indent << "READ(" << cell(op.offset) << ");\n";
+                }
+                break;
+            case BfOpKind::WRITE_STDOUT:
+                for (int64_t i = 0; i < op.argument; i++) {
+                    body << indent << "WRITE(" << cell(op.offset) << ");\n";
+                }
+                break;
+            case BfOpKind::LOOP_SET_TO_ZERO:
+                body << indent << cell(op.offset) << " = 0;\n";
+                break;
+            case BfOpKind::SET_DATA:
+                body << indent << cell(op.offset) << " = " << constant(op.argument) << ";\n";
+                break;
+            case BfOpKind::LOOP_MOVE_PTR:
+                body << indent << "while (p[0]) p += " << op.argument << ";\n";
+                break;
+            case BfOpKind::LOOP_MOVE_DATA:
+                body << indent << "{\n";
+                body << indent << "    cell v = " << cell(op.offset) << ";\n";
+                for (auto& t : op.targets) {
+                    body << indent << "    " << cell(op.offset + t.offset) << " += (cell)(v * "
+                         << constant(t.factor) << ");\n";
+                }
+                body << indent << "    " << cell(op.offset) << " = 0;\n";
+                body << indent << "}\n";
+                break;
+            case BfOpKind::JUMP_IF_DATA_ZERO:
+                body << indent << "while (p[0]) {\n";
+                indent += "    ";
+                break;
+            case BfOpKind::JUMP_IF_DATA_NOT_ZERO:
+                if (indent.size() <= 4) {
+                    std::cerr << "Unmatched closing ']' at pc=" << pc;
+                    exit(1);
+                }
+                indent.resize(indent.size() - 4);
+                body << indent << "}\n";
+                break;
+            case BfOpKind::INVALID_OP:
+            default:
+                std::cerr << "Fatal: Unknown op at pc=" << pc << "(" << get_kind_str(op.kind) << ")";
+                exit(1);
+        }
+
+        chunk_statements++;
+        if (chunk_statements >= C_JIT_CHUNK_STATEMENTS && indent.size() == 4) {
+            finish_chunk();
+        }
+    }
+    if (chunk_statements > 0 || chunk_count == 0) {
+        finish_chunk();
+    }
+
+    out << "void bf_run(uint8_t* tape, struct BfIo* io) {\n";
+    out << "    cell* p = (cell*)tape;\n";
+    for (size_t i = 0; i < chunk_count; i++) {
+        out << "    p = chunk_" << i << "(p, io);\n";
+    }
+    out << "}\n";
+    return out.str();
+}
@@ -0,0 +1,29 @@
+#ifndef C_JIT_H
+#define C_JIT_H
+
+#include "executor.h"
+#include "ir.h"
+
+#include <string>
+#include <vector>
+
+// Lowers the optimized IR to C, builds it into a shared object with the
+// system compiler ($CC, or cc) at -O3 and runs it through dlopen. Compiling
+// takes a few hundred milliseconds, which only pays off for long-running
+// programs.
+class CJit : public Executor {
+public:
+    CJit() {};
+    ~CJit() override;
+    void pre_execute_in_parsing_phase(const Program& p, bool verbose) override;
+    void execute(const Program& p, bool verbose) override;
+    void execute_on(const Program& p, uint8_t* tape, BfIo* io) const override;
+
+private:
+    std::string emit_c_source(const std::vector<BfOp>& ops);
+
+    void* library = nullptr;
+    void* bf_run = nullptr;
+};
+
+#endif
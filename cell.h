@@ -0,0 +1,22 @@
+#ifndef CELL_H
+#define CELL_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+// Runs STATEMENT with Cell bound to the unsigned integer type of the given
+// --cell-width, so a templated executor body is instantiated once per width
+// and picked at runtime.
+#define WITH_CELL_TYPE(width, STATEMENT) \
+    switch (width) { \
+        case 8: { using Cell = uint8_t; STATEMENT; } break; \
+        case 16: { using Cell = uint16_t; STATEMENT; } break; \
+        case 32: { using Cell = uint32_t; STATEMENT; } break; \
+        case 64: { using Cell = uint64_t; STATEMENT; } break; \
+        default: \
+            std::cerr << "Fatal: Unsupported cell width " << (width) << std::endl; \
+            exit(1); \
+    }
+
+#endif
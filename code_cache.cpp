@@ -0,0 +1,117 @@
+#include "code_cache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bump when the layout of emitted code changes.
+constexpr uint32_t CODE_CACHE_VERSION = 6;
+// Code starts on its own page so it can be mapped directly.
+constexpr size_t CODE_CACHE_HEADER_SIZE = 4096;
+constexpr char CODE_CACHE_MAGIC[8] = {'B', 'F', 'J', 'C', 'O', 'D', 'E', '\0'};
+
+struct CodeCacheHeader {
+    char magic[8];
+    uint64_t check;
+    uint64_t code_size;
+};
+
+uint64_t fnv1a(const std::string& data, uint64_t hash) {
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+std::string cpu_features() {
+    std::string features;
+    if (__builtin_cpu_supports("sse2")) {
+        features += "sse2,";
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        features += "avx2,";
+    }
+    return features;
+}
+
+CodeCache::CodeCache(const std::string& engine, const Program& p, const Options& options) {
+    if (options.code_cache_dir.empty()) {
+        return;
+    }
+
+    std::ostringstream key;
+    key << CODE_CACHE_VERSION << '\0' << engine << '\0' << options.cell_width << '\0'
+        << options.loop_profile << '\0' << options.partial_eval_steps << '\0'
+        << cpu_features() << '\0' << p.instructions;
+    uint64_t name = fnv1a(key.str(), 0xcbf29ce484222325ull);
+    check_ = fnv1a(key.str(), 0x84222325cbf29ce4ull);
+
+    if (mkdir(options.code_cache_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        perror("mkdir");
+        exit(1);
+    }
+    char file_name[32];
+    snprintf(file_name, sizeof(file_name), "/%016llx.bin", static_cast<unsigned long long>(name));
+    path_ = options.code_cache_dir + file_name;
+}
+
+std::unique_ptr<JitProgram> CodeCache::load() {
+    if (path_.empty()) {
+        return nullptr;
+    }
+
+    int fd = open(path_.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    std::unique_ptr<JitProgram> program;
+    CodeCacheHeader header;
+    struct stat st;
+    if (pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        memcmp(header.magic, CODE_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+        header.check == check_ && fstat(fd, &st) == 0 &&
+        static_cast<uint64_t>(st.st_size) == CODE_CACHE_HEADER_SIZE + header.code_size) {
+        void* code = mmap(nullptr, header.code_size, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, CODE_CACHE_HEADER_SIZE);
+        if (code != MAP_FAILED) {
+            program.reset(new JitProgram(code, header.code_size));
+        }
+    }
+    close(fd);
+    return program;
+}
+
+void CodeCache::store(const std::vector<uint8_t>& code) {
+    if (path_.empty()) {
+        return;
+    }
+
+    std::vector<uint8_t> entry(CODE_CACHE_HEADER_SIZE, 0);
+    CodeCacheHeader header;
+    memcpy(header.magic, CODE_CACHE_MAGIC, sizeof(header.magic));
+    header.check = check_;
+    header.code_size = code.size();
+    memcpy(entry.data(), &header, sizeof(header));
+    entry.insert(entry.end(), code.begin(), code.end());
+
+    // Write to a private file and rename it into place, so concurrent runs
+    // never see a partial entry.
+    std::string tmp_path = path_ + "." + std::to_string(getpid()) + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "wb");
+    if (f == nullptr) {
+        perror("fopen");
+        return;
+    }
+    bool written = fwrite(entry.data(), 1, entry.size(), f) == entry.size();
+    if (fclose(f) != 0 || !written || rename(tmp_path.c_str(), path_.c_str()) != 0) {
+        std::cerr << "Warning: Unable to write code cache entry " << path_ << std::endl;
+        unlink(tmp_path.c_str());
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef CODE_CACHE_H
+#define CODE_CACHE_H
+
+#include "executor.h"
+#include "jit_utils.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Content-addressed on-disk cache of JIT code (--code-cache=<dir>).
+//
+// Entries are keyed by a hash of the program, the engine, the options that
+// affect codegen and the CPU features. The JIT backends emit
+// position-independent code that reaches everything outside itself
+// (BfIo callbacks, scan helpers) through pointers passed in at run time, so
+// an entry needs no relocation and is mapped straight back executable.
+class CodeCache {
+public:
+    // Disabled when options.code_cache_dir is empty.
+    CodeCache(const std::string& engine, const Program& p, const Options& options);
+
+    // Returns nullptr on a miss.
+    std::unique_ptr<JitProgram> load();
+    void store(const std::vector<uint8_t>& code);
+
+private:
+    std::string path_;
+    // Independent hash of the same key, stored in the entry to catch
+    // collisions of the file name hash.
+    uint64_t check_ = 0;
+};
+
+#endif
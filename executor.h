@@ -1,18 +1,57 @@
 #ifndef EXECUTOR_H
 #define EXECUTOR_H
 
+#include "options.h"
+
+#include <algorithm>
+#include <cstdint>
 #include <string>
+#include <vector>
+
+struct BfIo;
 
-constexpr int MEMORY_SIZE = 30000;
+// Instructions from pc on sat back to back in the source file from byte
+// offset on, up to the next run.
+struct SourceRun {
+    size_t pc;
+    size_t offset;
+};
 
 struct Program {
     std::string instructions;
+    // Ordered by pc; a program without comments is a single run.
+    std::vector<SourceRun> source_runs;
+
+    // Byte offset in the source file of instruction pc.
+    size_t source_offset(size_t pc) const {
+        auto run = std::upper_bound(source_runs.begin(), source_runs.end(), pc,
+                                    [](size_t pc, const SourceRun& run) { return pc < run.pc; });
+        if (run == source_runs.begin()) {
+            return pc;
+        }
+        --run;
+        return run->offset + (pc - run->pc);
+    }
 };
 
 class Executor {
 public:
+    virtual ~Executor() {}
+
+    void set_options(const Options& options) {
+        this->options = options;
+    }
+
     virtual void pre_execute_in_parsing_phase(const Program& p, bool verbose) = 0;
     virtual void execute(const Program& p, bool verbose) = 0;
+
+    // Runs p, already passed to pre_execute_in_parsing_phase, on a zeroed
+    // tape whose cell 0 is at tape. Batch runs call this from several
+    // threads at once, so it must leave the executor unchanged.
+    virtual void execute_on(const Program& p, uint8_t* tape, BfIo* io) const = 0;
+
+protected:
+    Options options;
 };
 
 #endif
@@ -0,0 +1,233 @@
+#include "ir.h"
+
+#include <emmintrin.h>
+#include <iostream>
+#include <stack>
+
+// Length of the run of identical instructions starting at pc, compared 16
+// at a time.
+size_t calculate_repeated_insn_count(const Program& p, size_t pc) {
+    const char* insns = p.instructions.data();
+    size_t size = p.instructions.size();
+    char insn = insns[pc];
+    const __m128i pattern = _mm_set1_epi8(insn);
+
+    size_t end = pc + 1;
+    for (; end + 16 <= size; end += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(insns + end));
+        uint32_t different = ~_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern)) & 0xFFFF;
+        if (different) {
+            return end + __builtin_ctz(different) - pc;
+        }
+    }
+    while (end < size && insns[end] == insn) {
+        end++;
+    }
+    return end - pc;
+}
+
+std::vector<BfOp> parse_bf_ops(const Program& p) {
+    std::vector<BfOp> ops;
+
+    size_t pc = 0;
+
+    while (pc < p.instructions.size()) {
+        size_t start = pc;
+        char insn = p.instructions[pc];
+        size_t repeated_count = insn == '[' || insn == ']' ? 1 : calculate_repeated_insn_count(p, pc);
+        switch (insn) {
+            case '>':
+                ops.push_back(BfOp(BfOpKind::INC_PTR, repeated_count));
+                pc += repeated_count;
+                break;
+            case '<':
+                ops.push_back(BfOp(BfOpKind::DEC_PTR, repeated_count));
+                pc += repeated_count;
+                break;
+            case '+':
+                ops.push_back(BfOp(BfOpKind::INC_DATA, repeated_count));
+                pc += repeated_count;
+                break;
+            case '-':
+                ops.push_back(BfOp(BfOpKind::DEC_DATA, repeated_count));
+                pc += repeated_count;
+                break;
+            case '.':
+                ops.push_back(BfOp(BfOpKind::WRITE_STDOUT, repeated_count));
+                pc += repeated_count;
+                break;
+            case ',':
+                ops.push_back(BfOp(BfOpKind::READ_STDIN, repeated_count));
+                pc += repeated_count;
+                break;
+            case '[':
+                ops.push_back(BfOp(BfOpKind::JUMP_IF_DATA_ZERO, 0));
+                pc++;
+                break;
+            case ']':
+                ops.push_back(BfOp(BfOpKind::JUMP_IF_DATA_NOT_ZERO, 0));
+                pc++;
+                break;
+            default:
+                std::cerr << "Fatal: bad char'" << insn << "'at pc=" << pc;
+                exit(1);
+        }
+        ops.back().source = start;
+    }
+
+    link_jumps(ops);
+    return ops;
+}
+
+void link_jumps(std::vector<BfOp>& ops) {
+    std::stack<size_t> loop_block_stack;
+
+    for (size_t pc = 0; pc < ops.size(); pc++) {
+        if (ops[pc].kind == BfOpKind::JUMP_IF_DATA_ZERO) {
+            loop_block_stack.push(pc);
+        } else if (ops[pc].kind == BfOpKind::JUMP_IF_DATA_NOT_ZERO) {
+            if (loop_block_stack.empty()) {
+                std::cerr << "Fatal: Unmatched ']' at op=" << pc << std::endl;
+                exit(1);
+            }
+            size_t loop_start = loop_block_stack.top();
+            loop_block_stack.pop();
+            ops[loop_start].argument = pc;
+            ops[pc].argument = loop_start;
+        }
+    }
+
+    if (!loop_block_stack.empty()) {
+        std::cerr << "Fatal: Unmatched '[' at op=" << loop_block_stack.top() << std::endl;
+        exit(1);
+    }
+}
+
+LoopTree build_loop_tree(const std::vector<BfOp>& ops) {
+    LoopTree tree;
+    std::stack<size_t> open_loops;
+
+    for (size_t pc = 0; pc < ops.size(); pc++) {
+        if (ops[pc].kind == BfOpKind::JUMP_IF_DATA_ZERO) {
+            BfLoop loop;
+            loop.open = pc;
+            loop.close = ops[pc].argument;
+            loop.depth = open_loops.size();
+
+            size_t index = tree.loops.size();
+            if (open_loops.empty()) {
+                tree.roots.push_back(index);
+            } else {
+                tree.loops[open_loops.top()].children.push_back(index);
+            }
+            tree.loops.push_back(loop);
+            open_loops.push(index);
+        } else if (ops[pc].kind == BfOpKind::JUMP_IF_DATA_NOT_ZERO) {
+            open_loops.pop();
+        }
+    }
+
+    return tree;
+}
+
+std::vector<std::vector<BfOp>> split_top_level_regions(const std::vector<BfOp>& ops, size_t min_ops) {
+    std::vector<std::vector<BfOp>> regions(1);
+    size_t depth = 0;
+
+    for (const BfOp& op : ops) {
+        if (op.kind == BfOpKind::JUMP_IF_DATA_ZERO) {
+            if (depth == 0 && !regions.back().empty() && regions.back().size() >= min_ops) {
+                regions.emplace_back();
+            }
+            depth++;
+        } else if (op.kind == BfOpKind::JUMP_IF_DATA_NOT_ZERO) {
+            depth--;
+        }
+        regions.back().push_back(op);
+    }
+
+    for (auto& region : regions) {
+        link_jumps(region);
+    }
+    return regions;
+}
+
+void dump_bf_ops(const std::vector<BfOp>& ops, std::ostream& out) {
+    for (size_t pc = 0; pc < ops.size(); pc++) {
+        out << pc << ":\t" << get_kind_str(ops[pc].kind) << "\t" << ops[pc].argument;
+        if (ops[pc].offset != 0) {
+            out << " @" << ops[pc].offset;
+        }
+        for (auto& t : ops[pc].targets) {
+            out << " [" << t.offset << "]*" << t.factor;
+        }
+        if (ops[pc].never_taken) {
+            out << " (never taken)";
+        }
+        out << "\n";
+    }
+}
+
+BfOpKind get_kind_from_str(const std::string& str) {
+    for (size_t k = 0; k < BF_OP_KIND_COUNT; k++) {
+        BfOpKind kind = static_cast<BfOpKind>(k);
+        if (get_kind_str(kind) == str) {
+            return kind;
+        }
+    }
+    return BfOpKind::INVALID_OP;
+}
+
+std::string get_kind_char(BfOpKind kind) {
+    switch (kind) {
+        case BfOpKind::INC_PTR:
+            return ">";
+        case BfOpKind::DEC_PTR:
+            return "<";
+        case BfOpKind::INC_DATA:
+            return "+";
+        case BfOpKind::DEC_DATA:
+            return "-";
+        case BfOpKind::WRITE_STDOUT:
+            return ".";
+        case BfOpKind::READ_STDIN:
+            return ",";
+        case BfOpKind::JUMP_IF_DATA_ZERO:
+            return "[";
+        case BfOpKind::JUMP_IF_DATA_NOT_ZERO:
+            return "]";
+        default:
+            return "?";
+    }
+}
+
+std::string get_kind_str(BfOpKind kind) {
+    switch (kind) {
+        case BfOpKind::INC_PTR:
+            return "INC_PTR";
+        case BfOpKind::DEC_PTR:
+            return "DEC_PTR";
+        case BfOpKind::INC_DATA:
+            return "INC_DATA";
+        case BfOpKind::DEC_DATA:
+            return "DEC_DATA";
+        case BfOpKind::WRITE_STDOUT:
+            return "WRITE_STDOUT";
+        case BfOpKind::READ_STDIN:
+            return "READ_STDIN";
+        case BfOpKind::LOOP_SET_TO_ZERO:
+            return "LOOP_SET_TO_ZERO";
+        case BfOpKind::SET_DATA:
+            return "SET_DATA";
+        case BfOpKind::LOOP_MOVE_PTR:
+            return "LOOP_MOVE_PTR";
+        case BfOpKind::LOOP_MOVE_DATA:
+            return "LOOP_MOVE_DATA";
+        case BfOpKind::JUMP_IF_DATA_ZERO:
+            return "JUMP_IF_DATA_ZERO";
+        case BfOpKind::JUMP_IF_DATA_NOT_ZERO:
+            return "JUMP_IF_DATA_NOT_ZERO";
+        default:
+            return "UNKNOWN";
+    }
+}
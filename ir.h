@@ -0,0 +1,95 @@
+#ifndef IR_H
+#define IR_H
+
+#include "executor.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+enum class BfOpKind {
+    INVALID_OP = 0,
+    INC_PTR,
+    DEC_PTR,
+    INC_DATA,
+    DEC_DATA,
+    READ_STDIN,
+    WRITE_STDOUT,
+    LOOP_SET_TO_ZERO,
+    SET_DATA,
+    LOOP_MOVE_PTR,
+    LOOP_MOVE_DATA,
+    JUMP_IF_DATA_ZERO,
+    JUMP_IF_DATA_NOT_ZERO,
+};
+
+// Must follow the last BfOpKind; used to size per-kind tables.
+constexpr size_t BF_OP_KIND_COUNT = static_cast<size_t>(BfOpKind::JUMP_IF_DATA_NOT_ZERO) + 1;
+
+std::string get_kind_str(BfOpKind kind);
+std::string get_kind_char(BfOpKind kind);
+// Inverse of get_kind_str; INVALID_OP for unknown names.
+BfOpKind get_kind_from_str(const std::string& str);
+
+// LOOP_MOVE_DATA adds factor * data to the cell at dataptr + offset for
+// every target, then clears the cell at dataptr.
+struct MulTarget {
+    int64_t offset;
+    int64_t factor;
+};
+
+// For JUMP_IF_DATA_ZERO / JUMP_IF_DATA_NOT_ZERO, argument holds the index of
+// the matching bracket op once link_jumps() has run.
+//
+// Data, I/O and LOOP_MOVE_DATA ops act on the cell at dataptr + offset; the
+// pointer itself only moves through INC_PTR / DEC_PTR / LOOP_MOVE_PTR.
+struct BfOp {
+    BfOp(BfOpKind kind, int64_t argument_param) : kind(kind), argument(argument_param) {};
+    BfOp(BfOpKind kind, int64_t argument_param, int64_t offset_param)
+        : kind(kind), argument(argument_param), offset(offset_param) {};
+
+    BfOpKind kind = BfOpKind::INVALID_OP;
+    int64_t argument = 0;
+    int64_t offset = 0;
+    std::vector<MulTarget> targets;
+    // Index in Program::instructions of the first instruction this op was
+    // parsed from. Passes keep it on the bracket ops they copy.
+    size_t source = 0;
+    // Set by propagate_cell_values on bracket ops whose jump provably never
+    // happens. Backends may leave out the test; ignoring it is still correct.
+    bool never_taken = false;
+};
+
+// One loop of the program. open/close are the indices of its bracket ops.
+struct BfLoop {
+    size_t open = 0;
+    size_t close = 0;
+    size_t depth = 0;
+    std::vector<size_t> children;
+};
+
+// Loops are stored in the order of their opening brackets, so a loop always
+// precedes the loops nested in it.
+struct LoopTree {
+    std::vector<BfLoop> loops;
+    std::vector<size_t> roots;
+};
+
+// Translates p into run-length encoded ops with linked jumps.
+std::vector<BfOp> parse_bf_ops(const Program& p);
+
+// Recomputes the bracket targets of all jump ops. Exits on unbalanced brackets.
+void link_jumps(std::vector<BfOp>& ops);
+
+LoopTree build_loop_tree(const std::vector<BfOp>& ops);
+
+// Cuts balanced ops before top-level '['s into regions of at least min_ops
+// ops (the last one may be shorter), each with its own linked jumps. No
+// jump crosses a cut and every cut is a basic block boundary, so the
+// regions can be optimized and compiled independently and concatenated.
+std::vector<std::vector<BfOp>> split_top_level_regions(const std::vector<BfOp>& ops, size_t min_ops);
+
+void dump_bf_ops(const std::vector<BfOp>& ops, std::ostream& out);
+
+#endif
@@ -0,0 +1,335 @@
+#include "jit_symbols.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <elf.h>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// gdb's JIT interface: gdb sets a breakpoint in __jit_debug_register_code
+// and reads the object files listed in __jit_debug_descriptor when it hits.
+extern "C" {
+
+enum JitActions : uint32_t {
+    JIT_NOACTION = 0,
+    JIT_REGISTER_FN,
+    JIT_UNREGISTER_FN,
+};
+
+struct jit_code_entry {
+    jit_code_entry* next_entry;
+    jit_code_entry* prev_entry;
+    const char* symfile_addr;
+    uint64_t symfile_size;
+};
+
+struct jit_descriptor {
+    uint32_t version;
+    uint32_t action_flag;
+    jit_code_entry* relevant_entry;
+    jit_code_entry* first_entry;
+};
+
+void __attribute__((noinline)) __jit_debug_register_code() {
+    asm volatile("" ::: "memory");
+}
+
+jit_descriptor __jit_debug_descriptor = {1, JIT_NOACTION, nullptr, nullptr};
+
+}
+
+// jitdump format, see tools/perf/Documentation/jitdump-specification.txt in
+// the Linux tree.
+constexpr uint32_t JITDUMP_MAGIC = 0x4A695444;
+constexpr uint32_t JITDUMP_VERSION = 1;
+constexpr uint32_t JITDUMP_CODE_LOAD = 0;
+
+struct JitdumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct JitdumpCodeLoad {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+// Guards the perf map, the jitdump file and gdb's list, since the tiered
+// interpreter compiles from several threads.
+std::mutex jit_symbols_mutex;
+FILE* jitdump_file = nullptr;
+uint64_t jitdump_code_index = 0;
+
+std::vector<JitSymbol> flatten_jit_symbols(const std::string& outer_name, size_t size,
+                                           std::vector<JitSymbol> nested) {
+    std::sort(nested.begin(), nested.end(), [](const JitSymbol& a, const JitSymbol& b) {
+        return a.offset < b.offset || (a.offset == b.offset && a.size > b.size);
+    });
+
+    std::vector<JitSymbol> result;
+    std::vector<JitSymbol> open = {JitSymbol{outer_name, 0, size}};
+    size_t pos = 0;
+    // Names [pos, end) after the innermost open range.
+    auto emit_until = [&](size_t end) {
+        if (end > pos) {
+            result.push_back(JitSymbol{open.back().name, pos, end - pos});
+            pos = end;
+        }
+    };
+    for (auto& range : nested) {
+        while (open.size() > 1 && open.back().offset + open.back().size <= range.offset) {
+            emit_until(open.back().offset + open.back().size);
+            open.pop_back();
+        }
+        emit_until(range.offset);
+        open.push_back(range);
+    }
+    while (!open.empty()) {
+        emit_until(open.back().offset + open.back().size);
+        open.pop_back();
+    }
+    return result;
+}
+
+std::string jit_loop_symbol(size_t source_offset) {
+    return "bf_loop_" + std::to_string(source_offset);
+}
+
+uint64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void write_perf_map(const uint8_t* code, const std::vector<JitSymbol>& symbols) {
+    std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+    FILE* map = fopen(path.c_str(), "a");
+    if (map == nullptr) {
+        perror(path.c_str());
+        return;
+    }
+    for (auto& s : symbols) {
+        fprintf(map, "%lx %zx %s\n", reinterpret_cast<unsigned long>(code + s.offset), s.size, s.name.c_str());
+    }
+    fclose(map);
+}
+
+// perf only picks up the file if this process maps it executable, which
+// puts an MMAP record naming it into perf.data.
+FILE* open_jitdump() {
+    const char* dir = getenv("JITDUMPDIR");
+    std::string path = std::string(dir != nullptr ? dir : "/tmp") + "/jit-" + std::to_string(getpid()) + ".dump";
+    int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0) {
+        perror(path.c_str());
+        return nullptr;
+    }
+    void* marker = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+    if (marker == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return nullptr;
+    }
+
+    FILE* file = fdopen(fd, "wb");
+    JitdumpHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = JITDUMP_MAGIC;
+    header.version = JITDUMP_VERSION;
+    header.total_size = sizeof(header);
+    header.elf_mach = EM_X86_64;
+    header.pid = getpid();
+    header.timestamp = monotonic_ns();
+    fwrite(&header, sizeof(header), 1, file);
+    return file;
+}
+
+void write_jitdump(const uint8_t* code, const std::vector<JitSymbol>& symbols) {
+    if (jitdump_file == nullptr) {
+        jitdump_file = open_jitdump();
+        if (jitdump_file == nullptr) {
+            return;
+        }
+    }
+
+    for (auto& s : symbols) {
+        JitdumpCodeLoad record;
+        record.id = JITDUMP_CODE_LOAD;
+        record.total_size = sizeof(record) + s.name.size() + 1 + s.size;
+        record.timestamp = monotonic_ns();
+        record.pid = getpid();
+        record.tid = syscall(SYS_gettid);
+        record.vma = reinterpret_cast<uint64_t>(code + s.offset);
+        record.code_addr = record.vma;
+        record.code_size = s.size;
+        record.code_index = jitdump_code_index++;
+        fwrite(&record, sizeof(record), 1, jitdump_file);
+        fwrite(s.name.c_str(), s.name.size() + 1, 1, jitdump_file);
+        fwrite(code + s.offset, s.size, 1, jitdump_file);
+    }
+    fflush(jitdump_file);
+}
+
+template <typename T>
+void append_struct(std::vector<uint8_t>* out, const T& value) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    out->insert(out->end(), bytes, bytes + sizeof(T));
+}
+
+Elf64_Shdr make_jit_section(uint32_t name, uint32_t type, uint64_t flags, uint64_t addr,
+                            uint64_t offset, uint64_t size) {
+    Elf64_Shdr shdr;
+    memset(&shdr, 0, sizeof(shdr));
+    shdr.sh_name = name;
+    shdr.sh_type = type;
+    shdr.sh_flags = flags;
+    shdr.sh_addr = addr;
+    shdr.sh_offset = offset;
+    shdr.sh_size = size;
+    shdr.sh_addralign = 1;
+    return shdr;
+}
+
+// A relocatable object with nothing but the symbols: .text is NOBITS at
+// the code's address, and each symbol's value is its offset in .text.
+std::vector<uint8_t> build_gdb_object(const uint8_t* code, size_t size, const std::vector<JitSymbol>& symbols) {
+    const char shstrtab[] = "\0.shstrtab\0.strtab\0.symtab\0.text";
+    enum { SH_NULL, SH_SHSTRTAB, SH_STRTAB, SH_SYMTAB, SH_TEXT, SH_COUNT };
+
+    std::string strtab(1, '\0');
+    std::vector<Elf64_Sym> symtab(1);
+    memset(&symtab[0], 0, sizeof(Elf64_Sym));
+    for (auto& s : symbols) {
+        Elf64_Sym sym;
+        memset(&sym, 0, sizeof(sym));
+        sym.st_name = strtab.size();
+        sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_FUNC);
+        sym.st_shndx = SH_TEXT;
+        sym.st_value = s.offset;
+        sym.st_size = s.size;
+        symtab.push_back(sym);
+        strtab += s.name;
+        strtab += '\0';
+    }
+
+    std::vector<uint8_t> out;
+    Elf64_Ehdr ehdr;
+    memset(&ehdr, 0, sizeof(ehdr));
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr.e_type = ET_REL;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_shentsize = sizeof(Elf64_Shdr);
+    ehdr.e_shnum = SH_COUNT;
+    ehdr.e_shstrndx = SH_SHSTRTAB;
+    append_struct(&out, ehdr);
+
+    uint64_t shstrtab_offset = out.size();
+    out.insert(out.end(), shstrtab, shstrtab + sizeof(shstrtab));
+    uint64_t strtab_offset = out.size();
+    out.insert(out.end(), strtab.begin(), strtab.end());
+    while (out.size() % 8 != 0) {
+        out.push_back(0);
+    }
+    uint64_t symtab_offset = out.size();
+    for (auto& sym : symtab) {
+        append_struct(&out, sym);
+    }
+
+    uint64_t shoff = out.size();
+    append_struct(&out, make_jit_section(0, SHT_NULL, 0, 0, 0, 0));
+    append_struct(&out, make_jit_section(1, SHT_STRTAB, 0, 0, shstrtab_offset, sizeof(shstrtab)));
+    append_struct(&out, make_jit_section(11, SHT_STRTAB, 0, 0, strtab_offset, strtab.size()));
+    Elf64_Shdr symtab_header = make_jit_section(19, SHT_SYMTAB, 0, 0, symtab_offset,
+                                                symtab.size() * sizeof(Elf64_Sym));
+    symtab_header.sh_link = SH_STRTAB;
+    // Every symbol is local.
+    symtab_header.sh_info = symtab.size();
+    symtab_header.sh_addralign = 8;
+    symtab_header.sh_entsize = sizeof(Elf64_Sym);
+    append_struct(&out, symtab_header);
+    append_struct(&out, make_jit_section(27, SHT_NOBITS, SHF_ALLOC | SHF_EXECINSTR,
+                                         reinterpret_cast<uint64_t>(code), 0, size));
+
+    Elf64_Ehdr* header = reinterpret_cast<Elf64_Ehdr*>(out.data());
+    header->e_shoff = shoff;
+    return out;
+}
+
+JitRegistration::JitRegistration(const Options& options, const void* code, size_t size,
+                                 const std::vector<JitSymbol>& symbols) {
+    if (!options.perf_map && !options.jitdump && !options.gdb_jit) {
+        return;
+    }
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(code);
+    std::lock_guard<std::mutex> lock(jit_symbols_mutex);
+    if (options.perf_map) {
+        write_perf_map(bytes, symbols);
+    }
+    if (options.jitdump) {
+        write_jitdump(bytes, symbols);
+    }
+    if (options.gdb_jit) {
+        gdb_object_ = build_gdb_object(bytes, size, symbols);
+        jit_code_entry* entry = new jit_code_entry;
+        entry->symfile_addr = reinterpret_cast<const char*>(gdb_object_.data());
+        entry->symfile_size = gdb_object_.size();
+        entry->prev_entry = nullptr;
+        entry->next_entry = __jit_debug_descriptor.first_entry;
+        if (entry->next_entry != nullptr) {
+            entry->next_entry->prev_entry = entry;
+        }
+        __jit_debug_descriptor.first_entry = entry;
+        __jit_debug_descriptor.relevant_entry = entry;
+        __jit_debug_descriptor.action_flag = JIT_REGISTER_FN;
+        __jit_debug_register_code();
+        gdb_entry_ = entry;
+    }
+}
+
+JitRegistration::~JitRegistration() {
+    if (gdb_entry_ == nullptr) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(jit_symbols_mutex);
+    jit_code_entry* entry = static_cast<jit_code_entry*>(gdb_entry_);
+    if (entry->prev_entry != nullptr) {
+        entry->prev_entry->next_entry = entry->next_entry;
+    } else {
+        __jit_debug_descriptor.first_entry = entry->next_entry;
+    }
+    if (entry->next_entry != nullptr) {
+        entry->next_entry->prev_entry = entry->prev_entry;
+    }
+    __jit_debug_descriptor.relevant_entry = entry;
+    __jit_debug_descriptor.action_flag = JIT_UNREGISTER_FN;
+    __jit_debug_register_code();
+    delete entry;
+}
@@ -0,0 +1,48 @@
+#ifndef JIT_SYMBOLS_H
+#define JIT_SYMBOLS_H
+
+#include "options.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A named range of JIT code, relative to the start of its JitProgram.
+struct JitSymbol {
+    std::string name;
+    size_t offset;
+    size_t size;
+};
+
+// Turns properly nested ranges (e.g. loops) into disjoint symbols covering
+// [0, size), each byte named after the innermost range around it and bytes
+// outside all of them after outer_name. perf cannot attribute samples to
+// overlapping symbols.
+std::vector<JitSymbol> flatten_jit_symbols(const std::string& outer_name, size_t size,
+                                           std::vector<JitSymbol> nested);
+
+// "bf_loop_<offset>", for the loop starting at byte offset of the .bf file.
+std::string jit_loop_symbol(size_t source_offset);
+
+// Announces JIT code to profilers and debuggers as the options ask:
+// --perf-map appends the symbols to /tmp/perf-<pid>.map, --jitdump records
+// them with the code in jit-<pid>.dump (in $JITDUMPDIR, or /tmp) for
+// `perf inject --jit`, and --gdb-jit registers an in-memory ELF object with
+// gdb's JIT interface until the registration is destroyed.
+class JitRegistration {
+public:
+    JitRegistration(const Options& options, const void* code, size_t size,
+                    const std::vector<JitSymbol>& symbols);
+    ~JitRegistration();
+
+    JitRegistration(const JitRegistration&) = delete;
+    JitRegistration& operator=(const JitRegistration&) = delete;
+
+private:
+    // Owned by gdb's list while registered.
+    void* gdb_entry_ = nullptr;
+    std::vector<uint8_t> gdb_object_;
+};
+
+#endif
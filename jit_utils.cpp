@@ -36,7 +36,16 @@ JitProgram::JitProgram(const std::vector<uint8_t>& code) {
     }
 }
 
+JitProgram::JitProgram(void* mapped_code, size_t size)
+    : program_memory_(mapped_code), program_size_(size) {}
+
+void JitProgram::publish(const Options& options, const std::vector<JitSymbol>& symbols) {
+    registration_.reset(new JitRegistration(options, program_memory_, program_size_,
+                                            flatten_jit_symbols("bf_program", program_size_, symbols)));
+}
+
 JitProgram::~JitProgram() {
+    registration_.reset();
     if (program_memory_ != nullptr) {
         if (munmap(program_memory_, program_size_) < 0) {
             perror("munmap");
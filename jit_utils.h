@@ -1,6 +1,8 @@
 #ifndef JIT_UTILS_H
 #define JIT_UTILS_H
 
+#include "jit_symbols.h"
+
 #include <vector>
 #include <cstdint>
 #include <memory>
@@ -8,8 +10,13 @@
 class JitProgram {
 public:
     JitProgram(const std::vector<uint8_t>& code);
+    // Takes ownership of code already mapped executable.
+    JitProgram(void* mapped_code, size_t size);
     ~JitProgram();
 
+    JitProgram(const JitProgram&) = delete;
+    JitProgram& operator=(const JitProgram&) = delete;
+
     void* program_memory() {
         return program_memory_;
     }
@@ -18,9 +25,15 @@ public:
         return program_size_;
     }
 
+    // Names the code for perf and gdb as options asks (--perf-map,
+    // --jitdump, --gdb-jit). Symbols that don't cover the code are padded
+    // out with bf_program.
+    void publish(const Options& options, const std::vector<JitSymbol>& symbols);
+
 private:
     void* program_memory_ = nullptr;
     size_t program_size_ = 0;
+    std::unique_ptr<JitRegistration> registration_;
 };
 
 class CodeEmitter {
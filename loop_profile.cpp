@@ -0,0 +1,86 @@
+#include "loop_profile.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <stack>
+
+// Loops listed by report().
+constexpr size_t LOOP_PROFILE_ROWS = 20;
+// Instructions of a loop shown in the report.
+constexpr size_t LOOP_PROFILE_SNIPPET = 40;
+
+LoopProfile::LoopProfile(const std::vector<BfOp>& ops) {
+    // Each op counts towards the innermost loop around it.
+    std::stack<size_t> open_loops;
+    for (auto& op : ops) {
+        if (!open_loops.empty()) {
+            loops_[open_loops.top()].body_ops++;
+        }
+        if (op.kind == BfOpKind::JUMP_IF_DATA_ZERO) {
+            open_loops.push(loops_.size());
+            loops_.push_back(Loop{op.source, op.source, 0});
+        } else if (op.kind == BfOpKind::JUMP_IF_DATA_NOT_ZERO && !open_loops.empty()) {
+            loops_[open_loops.top()].source_end = op.source + 1;
+            open_loops.pop();
+        }
+    }
+    counters_.assign(loops_.size() * 2, 0);
+}
+
+LoopProfile::LoopProfile(const Program& p) {
+    std::stack<size_t> open_loops;
+    for (size_t pc = 0; pc < p.instructions.size(); pc++) {
+        char insn = p.instructions[pc];
+        if (!open_loops.empty()) {
+            loops_[open_loops.top()].body_ops++;
+        }
+        if (insn == '[') {
+            open_loops.push(loops_.size());
+            loops_.push_back(Loop{pc, pc, 0});
+        } else if (insn == ']' && !open_loops.empty()) {
+            loops_[open_loops.top()].source_end = pc + 1;
+            open_loops.pop();
+        }
+    }
+    counters_.assign(loops_.size() * 2, 0);
+}
+
+void LoopProfile::report(const Program& p, std::ostream& out) const {
+    std::vector<size_t> order;
+    double total_cost = 0;
+    for (size_t i = 0; i < loops_.size(); i++) {
+        if (counters_[2 * i + 1] > 0) {
+            order.push_back(i);
+            total_cost += static_cast<double>(counters_[2 * i + 1]) * loops_[i].body_ops;
+        }
+    }
+    auto cost = [this](size_t i) {
+        return static_cast<double>(counters_[2 * i + 1]) * loops_[i].body_ops;
+    };
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return cost(a) > cost(b); });
+
+    out << "Loop profile: " << order.size() << " of " << loops_.size() << " loops ran\n";
+    out << std::setw(8) << "offset" << std::setw(14) << "entries" << std::setw(16) << "iterations"
+        << std::setw(12) << "iter/entry" << std::setw(8) << "share" << "  loop\n";
+    for (size_t row = 0; row < order.size() && row < LOOP_PROFILE_ROWS; row++) {
+        const Loop& loop = loops_[order[row]];
+        uint64_t entries = counters_[2 * order[row]];
+        uint64_t iterations = counters_[2 * order[row] + 1];
+        size_t offset = p.source_offset(loop.source);
+
+        size_t length = loop.source_end - loop.source;
+        std::string snippet = p.instructions.substr(loop.source, std::min(length, LOOP_PROFILE_SNIPPET));
+        if (length > LOOP_PROFILE_SNIPPET) {
+            snippet += "...";
+        }
+        out << std::setw(8) << offset << std::setw(14) << entries << std::setw(16) << iterations
+            << std::setw(12) << std::fixed << std::setprecision(1)
+            << (entries ? static_cast<double>(iterations) / entries : 0.0)
+            << std::setw(7) << (total_cost > 0 ? cost(order[row]) * 100 / total_cost : 0.0) << "%"
+            << "  " << snippet << "\n";
+    }
+    if (order.size() > LOOP_PROFILE_ROWS) {
+        out << "(" << order.size() - LOOP_PROFILE_ROWS << " more)\n";
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef LOOP_PROFILE_H
+#define LOOP_PROFILE_H
+
+#include "executor.h"
+#include "ir.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+// Entry and iteration counts of every loop of a program, incremented
+// directly by JIT code built with --loop-profile. Loop i (in the order of
+// its '[') owns counters()[2 * i], bumped when the loop is entered, and
+// counters()[2 * i + 1], bumped at the top of every iteration.
+class LoopProfile {
+public:
+    // Loops of the optimized IR; loops the passes replaced are not counted.
+    explicit LoopProfile(const std::vector<BfOp>& ops);
+    // Loops of the unoptimized program.
+    explicit LoopProfile(const Program& p);
+
+    uint64_t* counters() {
+        return counters_.data();
+    }
+
+    // Ranks the loops by their estimated share of the time spent in loops:
+    // iterations times the ops in the body, not counting nested loops, which
+    // are ranked on their own.
+    void report(const Program& p, std::ostream& out) const;
+
+private:
+    struct Loop {
+        // Indices in Program::instructions of the '[' and past the ']'.
+        size_t source;
+        size_t source_end;
+        size_t body_ops;
+    };
+
+    std::vector<Loop> loops_;
+    std::vector<uint64_t> counters_;
+};
+
+#endif
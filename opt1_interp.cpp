@@ -1,4 +1,7 @@
 #include "opt1_interp.h"
+#include "bf_io.h"
+#include "cell.h"
+#include "tape.h"
 
 #ifdef BFTRACE
 #include <unordered_map>
@@ -7,37 +10,33 @@
 Opt1Interpreter::Opt1Interpreter() {}
 
 void Opt1Interpreter::compute_jumptable(const Program& p) {
-    size_t pc = 0;
     size_t program_size = p.instructions.size();
     std::vector<size_t> jumptable(program_size, 0);
+    std::vector<size_t> open_brackets;
 
-    while (pc < program_size) {
+    for (size_t pc = 0; pc < program_size; pc++) {
         char instruction = p.instructions[pc];
 
         if (instruction == '[') {
-            int bracket_nesting = 1;
-            size_t seek = pc;
-
-            while (bracket_nesting && ++seek < program_size) {
-                if (p.instructions[seek] == ']') {
-                    bracket_nesting--;
-                } else if (p.instructions[seek] == '['){
-                    bracket_nesting++;
-                }
-            }
-
-            if (!bracket_nesting) {
-                jumptable[pc] = seek;
-                jumptable[seek] = pc;
-            } else {
-                std::cerr << "Fatal: Unmatched '[' at pc=" << pc << std::endl;
+            open_brackets.push_back(pc);
+        } else if (instruction == ']') {
+            if (open_brackets.empty()) {
+                std::cerr << "Fatal: Unmatched ']' at pc=" << pc << std::endl;
                 exit(1);
             }
+            size_t open = open_brackets.back();
+            open_brackets.pop_back();
+            jumptable[open] = pc;
+            jumptable[pc] = open;
         }
-        pc++;
     }
 
-    this->jumptable = jumptable;
+    if (!open_brackets.empty()) {
+        std::cerr << "Fatal: Unmatched '[' at pc=" << open_brackets.back() << std::endl;
+        exit(1);
+    }
+
+    this->jumptable.swap(jumptable);
 }
 
 void Opt1Interpreter::pre_execute_in_parsing_phase(const Program& p, bool verbose) {
@@ -45,10 +44,20 @@ void Opt1Interpreter::pre_execute_in_parsing_phase(const Program& p, bool verbos
 }
 
 void Opt1Interpreter::execute(const Program& p, bool verbose) {
+    Tape tape;
+    StdIo stdio(options.async_io);
+    execute_on(p, tape.origin(), stdio.io());
+}
+
+void Opt1Interpreter::execute_on(const Program& p, uint8_t* tape, BfIo* io) const {
+    WITH_CELL_TYPE(options.cell_width, run(p, reinterpret_cast<Cell*>(tape), io));
+}
+
+template <typename Cell>
+void Opt1Interpreter::run(const Program& p, Cell* memory, BfIo* io) const {
     // Initialize state
-    std::vector<uint8_t> memory(MEMORY_SIZE, 0);
     size_t pc = 0;
-    size_t dataptr = 0;
+    int64_t dataptr = 0;
 
 #ifdef BFTRACE
     std::unordered_map<char, size_t> op_exec_count;
@@ -75,10 +84,10 @@ void Opt1Interpreter::execute(const Program& p, bool verbose) {
                 memory[dataptr]--;
                 break;
             case '.':
-                std::cout.put(memory[dataptr]);
+                bf_io_put(io, memory[dataptr]);
                 break;
             case ',':
-                memory[dataptr] = std::cin.get();
+                memory[dataptr] = bf_io_get(io);
                 break;
             case '[':
                 if (memory[dataptr] == 0) {
@@ -2,6 +2,7 @@
 #define OPT1_INTERP_H
 
 #include "executor.h"
+#include "bf_io.h"
 #include <vector>
 #include <iostream>
 
@@ -12,8 +13,12 @@ public:
     Opt1Interpreter();
     void pre_execute_in_parsing_phase(const Program& p, bool verbose) override;
     void execute(const Program& p, bool verbose) override;
+    void execute_on(const Program& p, uint8_t* tape, BfIo* io) const override;
 
 private:
+    template <typename Cell>
+    void run(const Program& p, Cell* memory, BfIo* io) const;
+
     std::vector<size_t> jumptable;
     void compute_jumptable(const Program& p);
 };
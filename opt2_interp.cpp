@@ -1,111 +1,43 @@
 #include "opt2_interp.h"
-#include <stack>
-#include <iomanip>
-
-#ifdef BFTRACE
-#include <unordered_map>
-#endif
+#include "bf_io.h"
+#include "cell.h"
+#include "tape.h"
+#include "passes.h"
+#include "trace.h"
 
 Opt2Interpreter::Opt2Interpreter() {}
 
-size_t calculate_repeated_insn_count(const Program& p, size_t pc) {
-    char insn = p.instructions[pc];
-    size_t c = 0;
-    while (insn == p.instructions[pc + c]) {
-        c++;
-    }
-    return c;
+void Opt2Interpreter::pre_execute_in_parsing_phase(const Program& p, bool verbose) {
+    PassManager pm = create_basic_pass_manager();
+    this->bf_ops = pm.run(p, verbose);
 }
 
-std::vector<BfOp> parse_bf_ops(const Program& p) {
-    std::vector<BfOp> ops;
-
-    size_t pc = 0;
-
-    while (pc < p.instructions.size()) {
-        size_t repeated_count = calculate_repeated_insn_count(p, pc);
-        char insn = p.instructions[pc];
-        switch (insn) {
-            case '>':
-                ops.push_back(BfOp(BfOpKind::INC_PTR, repeated_count));
-                pc += repeated_count;
-                break;
-            case '<':
-                ops.push_back(BfOp(BfOpKind::DEC_PTR, repeated_count));
-                pc += repeated_count;
-                break;
-            case '+':
-                ops.push_back(BfOp(BfOpKind::INC_DATA, repeated_count));
-                pc += repeated_count;
-                break;
-            case '-':
-                ops.push_back(BfOp(BfOpKind::DEC_DATA, repeated_count));
-                pc += repeated_count;
-                break;
-            case '.':
-                ops.push_back(BfOp(BfOpKind::WRITE_STDOUT, repeated_count));
-                pc += repeated_count;
-                break;
-            case ',':
-                ops.push_back(BfOp(BfOpKind::READ_STDIN, repeated_count));
-                pc += repeated_count;
-                break;
-            case '[':
-                ops.push_back(BfOp(BfOpKind::JUMP_IF_DATA_ZERO, 0));
-                pc += 1;
-                break;
-            case ']':
-                ops.push_back(BfOp(BfOpKind::JUMP_IF_DATA_NOT_ZERO, 0));
-                pc += 1;
-                break;
-            default:
-                std::cerr << "Fatal: bad char'" << insn << "'at pc=" << pc;
-                break;
-        }
-    }
-
-    pc = 0;
-    std::stack<size_t> block_stack;
-
-    while (pc < ops.size()) {
-        //std::cout << "pc: " << pc << ",\t kind=" << get_kind_str(ops[pc].kind) << ", \t arg=" << ops[pc].argument << std::endl;
-        if (ops[pc].kind == BfOpKind::JUMP_IF_DATA_ZERO) {
-            block_stack.push(pc);
-        }
-        if (ops[pc].kind == BfOpKind::JUMP_IF_DATA_NOT_ZERO) {
-            size_t target_pc = block_stack.top();
-            block_stack.pop();
-            size_t offset = pc - target_pc;
-            ops[pc].argument = offset;
-            ops[target_pc].argument = offset;
-        }
-        pc++;
-    }
-    return ops;
+void Opt2Interpreter::execute(const Program& p, bool verbose) {
+    Tape tape;
+    StdIo stdio(options.async_io);
+    execute_on(p, tape.origin(), stdio.io());
 }
 
-void Opt2Interpreter::pre_execute_in_parsing_phase(const Program& p, bool verbose) {
-    this->bf_ops = parse_bf_ops(p);
+void Opt2Interpreter::execute_on(const Program& p, uint8_t* tape, BfIo* io) const {
+    if (!options.trace_path.empty()) {
+        TraceWriter trace(options.trace_path, bf_ops);
+        WITH_CELL_TYPE(options.cell_width, run(p, reinterpret_cast<Cell*>(tape), io, &trace));
+    } else {
+        NoTrace trace;
+        WITH_CELL_TYPE(options.cell_width, run(p, reinterpret_cast<Cell*>(tape), io, &trace));
+    }
 }
 
-void Opt2Interpreter::execute(const Program& p, bool verbose) {
+template <typename Cell, typename Tracer>
+void Opt2Interpreter::run(const Program& p, Cell* memory, BfIo* io, Tracer* trace) const {
     // Initialize state
-    std::vector<uint8_t> memory(MEMORY_SIZE, 0);
     size_t pc = 0;
-    size_t dataptr = 0;
-
-#ifdef BFTRACE
-    std::unordered_map<int, size_t> op_exec_count;
-    std::string current_trace;
-    std::unordered_map<std::string, size_t> trace_count;
-#endif
+    int64_t dataptr = 0;
 
     while (pc < bf_ops.size()) {
         const BfOp& op = bf_ops[pc];
 
-#ifdef BFTRACE
-        op_exec_count[static_cast<int>(op.kind)]++;
-#endif
+        trace->record(pc, op.kind, dataptr);
 
         switch (op.kind) {
             case BfOpKind::INC_PTR:
@@ -121,23 +53,23 @@ void Opt2Interpreter::execute(const Program& p, bool verbose) {
                 memory[dataptr] -= op.argument;
                 break;
             case BfOpKind::WRITE_STDOUT:
-                for (size_t i = 0; i < op.argument; i++) {
-                    std::cout.put(memory[dataptr]);
+                for (int64_t i = 0; i < op.argument; i++) {
+                    bf_io_put(io, memory[dataptr]);
                 }
                 break;
             case BfOpKind::READ_STDIN:
-                for (size_t i = 0; i < op.argument; i++) {
-                    memory[dataptr] = std::cin.get();
+                for (int64_t i = 0; i < op.argument; i++) {
+                    memory[dataptr] = bf_io_get(io);
                 }
                 break;
             case BfOpKind::JUMP_IF_DATA_ZERO:
                 if (memory[dataptr] == 0) {
-                    pc += op.argument;
+                    pc = op.argument;
                 }
                 break;
             case BfOpKind::JUMP_IF_DATA_NOT_ZERO:
                 if (memory[dataptr] != 0) {
-                    pc -= op.argument;
+                    pc = op.argument;
                 }
                 break;
             default:
@@ -145,86 +77,6 @@ void Opt2Interpreter::execute(const Program& p, bool verbose) {
                 break;
         }
 
-#ifdef BFTRACE
-        if (op.kind == BfOpKind::JUMP_IF_DATA_ZERO) {
-            current_trace = "";
-        } else if (op.kind == BfOpKind::JUMP_IF_DATA_NOT_ZERO) {
-            trace_count[current_trace]++;
-            current_trace = "";
-        } else {
-            current_trace += get_kind_char(op.kind) + std::to_string(op.argument);
-        }
-#endif
         pc++;
     }
-
-#ifdef BFTRACE
-    std::cout << "* Tracing:\n";
-    std::cout.imbue(std::locale(""));
-    size_t total = 0;
-    for (auto i : op_exec_count) {
-        std::cout << i.first << "\t--> " << i.second << std::endl;
-        total += i.second;
-    }
-    std::cout << ".. Total: " << total << "\n";
-
-    std::pair<std::string, size_t> trace_pair;
-    std::vector<std::pair<std::string, size_t>> trace_pairs;
-    std::copy(trace_count.begin(), trace_count.end(),
-            std::back_inserter<std::vector<std::pair<std::string, size_t>>>(trace_pairs));
-    std::sort(trace_pairs.begin(), trace_pairs.end(),
-            [](const std::pair<std::string, size_t>& a, const std::pair<std::string, size_t>& b) {
-                return a.second > b.second;
-            });
-
-    for (auto const& p : trace_pairs) {
-        std::cout << std::setw(15) << std::left << p.first << " --> " << p.second << "\n";
-    }
-#endif
-}
-
-std::string get_kind_char(BfOpKind kind) {
-    switch (kind) {
-        case BfOpKind::INC_PTR:
-            return ">";
-        case BfOpKind::DEC_PTR:
-            return "<";
-        case BfOpKind::INC_DATA:
-            return "+";
-        case BfOpKind::DEC_DATA:
-            return "-";
-        case BfOpKind::WRITE_STDOUT:
-            return ".";
-        case BfOpKind::READ_STDIN:
-            return ",";
-        case BfOpKind::JUMP_IF_DATA_ZERO:
-            return "[";
-        case BfOpKind::JUMP_IF_DATA_NOT_ZERO:
-            return "]";
-        default:
-            return "?";
-    }
-}
-
-std::string get_kind_str(BfOpKind kind) {
-    switch (kind) {
-        case BfOpKind::INC_PTR:
-            return "INC_PTR";
-        case BfOpKind::DEC_PTR:
-            return "DEC_PTR";
-        case BfOpKind::INC_DATA:
-            return "INC_DATA";
-        case BfOpKind::DEC_DATA:
-            return "DEC_DATA";
-        case BfOpKind::WRITE_STDOUT:
-            return "WRITE_STDOUT";
-        case BfOpKind::READ_STDIN:
-            return "READ_STDIN";
-        case BfOpKind::JUMP_IF_DATA_ZERO:
-            return "JUMP_IF_DATA_ZERO";
-        case BfOpKind::JUMP_IF_DATA_NOT_ZERO:
-            return "JUMP_IF_DATA_NOT_ZERO";
-        default:
-            return "UNKNOWN";
-    }
 }
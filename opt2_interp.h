@@ -2,40 +2,23 @@
 #define OPT2_INTERP_H
 
 #include "executor.h"
+#include "bf_io.h"
+#include "ir.h"
 #include <vector>
 #include <iostream>
 
-//#define BFTRACE
-
-enum class BfOpKind {
-    INVALID_OP = 0,
-    INC_PTR,
-    DEC_PTR,
-    INC_DATA,
-    DEC_DATA,
-    READ_STDIN,
-    WRITE_STDOUT,
-    JUMP_IF_DATA_ZERO,
-    JUMP_IF_DATA_NOT_ZERO,
-};
-
-std::string get_kind_str(BfOpKind kind);
-std::string get_kind_char(BfOpKind kind);
-
-struct BfOp {
-    BfOp(BfOpKind kind, size_t argument_param) : kind(kind), argument(argument_param) {};
-
-    BfOpKind kind = BfOpKind::INVALID_OP;
-    size_t argument = 0;
-};
-
 class Opt2Interpreter : public Executor {
 public:
     Opt2Interpreter();
     void pre_execute_in_parsing_phase(const Program& p, bool verbose) override;
     void execute(const Program& p, bool verbose) override;
+    void execute_on(const Program& p, uint8_t* tape, BfIo* io) const override;
 
 private:
+    // Tracer is TraceWriter with --trace, NoTrace otherwise.
+    template <typename Cell, typename Tracer>
+    void run(const Program& p, Cell* memory, BfIo* io, Tracer* trace) const;
+
     std::vector<BfOp> bf_ops;
     std::vector<size_t> jumptable;
     void compute_jumptable(const Program& p);
@@ -2,44 +2,103 @@
 #define OPT3_INTERP_H
 
 #include "executor.h"
+#include "bf_io.h"
+#include "ir.h"
+#include "prefix_eval.h"
+#include "scan.h"
 #include <vector>
 #include <iostream>
 
-//#define BFTRACE
-
-enum class BfOpKind {
-    INVALID_OP = 0,
-    INC_PTR,
-    DEC_PTR,
-    INC_DATA,
-    DEC_DATA,
-    READ_STDIN,
-    WRITE_STDOUT,
-    LOOP_SET_TO_ZERO,
-    LOOP_MOVE_PTR,
-    LOOP_MOVE_DATA,
-    JUMP_IF_DATA_ZERO,
-    JUMP_IF_DATA_NOT_ZERO,
-};
+// The Opt3 dispatch loop: runs ops (with linked jumps) on the tape whose
+// cell 0 is at memory. Every op is reported to trace->record(pc, kind,
+// dataptr) before it runs; Opt3 passes TraceWriter with --trace and NoTrace
+// otherwise, and bf_superinsn counts op pairs through the same hook.
+template <typename Cell, typename Tracer>
+void run_opt3_ops(const std::vector<BfOp>& ops, Cell* memory, BfIo* io, Tracer* trace) {
+    // Initialize state
+    size_t pc = 0;
+    int64_t dataptr = 0;
 
-std::string get_kind_str(BfOpKind kind);
-std::string get_kind_char(BfOpKind kind);
+    while (pc < ops.size()) {
+        const BfOp& op = ops[pc];
 
-struct BfOp {
-    BfOp(BfOpKind kind, int64_t argument_param) : kind(kind), argument(argument_param) {};
+        trace->record(pc, op.kind, dataptr);
 
-    BfOpKind kind = BfOpKind::INVALID_OP;
-    int64_t argument = 0;
-};
+        switch (op.kind) {
+            case BfOpKind::INC_PTR:
+                dataptr += op.argument;
+                break;
+            case BfOpKind::DEC_PTR:
+                dataptr -= op.argument;
+                break;
+            case BfOpKind::INC_DATA:
+                memory[dataptr + op.offset] += op.argument;
+                break;
+            case BfOpKind::DEC_DATA:
+                memory[dataptr + op.offset] -= op.argument;
+                break;
+            case BfOpKind::WRITE_STDOUT:
+                for (int64_t i = 0; i < op.argument; i++) {
+                    bf_io_put(io, memory[dataptr + op.offset]);
+                }
+                break;
+            case BfOpKind::READ_STDIN:
+                for (int64_t i = 0; i < op.argument; i++) {
+                    memory[dataptr + op.offset] = bf_io_get(io);
+                }
+                break;
+            case BfOpKind::LOOP_SET_TO_ZERO:
+                memory[dataptr + op.offset] = 0;
+                break;
+            case BfOpKind::SET_DATA:
+                memory[dataptr + op.offset] = op.argument;
+                break;
+            case BfOpKind::LOOP_MOVE_PTR:
+                dataptr = scan_for_zero(&memory[dataptr], op.argument) - memory;
+                break;
+            case BfOpKind::LOOP_MOVE_DATA:
+                {
+                    int64_t control = dataptr + op.offset;
+                    if (memory[control]) {
+                        Cell data = memory[control];
+                        for (auto& t : op.targets) {
+                            memory[control + t.offset] += data * t.factor;
+                        }
+                        memory[control] = 0;
+                    }
+                }
+                break;
+            case BfOpKind::JUMP_IF_DATA_ZERO:
+                if (memory[dataptr] == 0) {
+                    pc = op.argument;
+                }
+                break;
+            case BfOpKind::JUMP_IF_DATA_NOT_ZERO:
+                if (memory[dataptr] != 0) {
+                    pc = op.argument;
+                }
+                break;
+            default:
+                std::cerr << "Fatal: Unknown op at pc=" << pc;
+                exit(1);
+                break;
+        }
+
+        pc++;
+    }
+}
 
 class Opt3Interpreter : public Executor {
 public:
     Opt3Interpreter();
     void pre_execute_in_parsing_phase(const Program& p, bool verbose) override;
     void execute(const Program& p, bool verbose) override;
+    void execute_on(const Program& p, uint8_t* tape, BfIo* io) const override;
 
 private:
     std::vector<BfOp> bf_ops;
+    // What --partial-eval ran before bf_ops.
+    PrefixSnapshot prefix;
     std::vector<size_t> jumptable;
     void compute_jumptable(const Program& p);
 };
@@ -1,17 +1,26 @@
 #include "opt_asmjit.h"
+#include "bf_io.h"
+#include "code_cache.h"
+#include "cell.h"
+#include "tape.h"
+#include "passes.h"
+#include "prefix_eval.h"
+#include "scan.h"
 #include "jit_utils.h"
 #include "asmjit/asmjit.h"
-
+#include "asmjit_utils.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <set>
 #include <stack>
+#include <thread>
 #include <iostream>
 
-void myputchar(uint8_t c) {
-    putchar(c);
-}
-
-uint8_t mygetchar() {
-    return getchar();
-}
+constexpr size_t CELL_REGISTER_COUNT = 7;
 
 class BracketLabels {
 public:
@@ -22,209 +31,436 @@ public:
     const asmjit::Label close_label;
 };
 
-size_t calculate_repeated_insn_count(const Program& p, size_t pc) {
-    char insn = p.instructions[pc];
-    size_t c = 0;
-    while (insn == p.instructions[pc + c]) {
-        c++;
+// Succeeds if the loop never moves the data pointer, so every cell it
+// touches has a fixed offset. I/O is allowed; the cells are spilled around
+// those calls.
+bool match_register_loop(const std::vector<BfOp>& ops, const BfLoop& loop, RegisterLoop* result) {
+    std::set<int64_t> cells;
+    std::set<int64_t> written;
+
+    for (size_t pc = loop.open; pc <= loop.close; pc++) {
+        const BfOp& op = ops[pc];
+        switch (op.kind) {
+            case BfOpKind::INC_DATA:
+            case BfOpKind::DEC_DATA:
+            case BfOpKind::SET_DATA:
+            case BfOpKind::LOOP_SET_TO_ZERO:
+                cells.insert(op.offset);
+                written.insert(op.offset);
+                break;
+            case BfOpKind::READ_STDIN:
+                cells.insert(op.offset);
+                written.insert(op.offset);
+                break;
+            case BfOpKind::WRITE_STDOUT:
+                cells.insert(op.offset);
+                break;
+            case BfOpKind::LOOP_MOVE_DATA:
+                cells.insert(op.offset);
+                written.insert(op.offset);
+                for (auto& t : op.targets) {
+                    cells.insert(op.offset + t.offset);
+                    written.insert(op.offset + t.offset);
+                }
+                break;
+            case BfOpKind::JUMP_IF_DATA_ZERO:
+            case BfOpKind::JUMP_IF_DATA_NOT_ZERO:
+                cells.insert(0);
+                break;
+            default:
+                return false;
+        }
+    }
+
+    if (cells.size() > CELL_REGISTER_COUNT) {
+        return false;
     }
-    return c;
+    result->close = loop.close;
+    result->cells.assign(cells.begin(), cells.end());
+    result->written.assign(written.begin(), written.end());
+    return true;
 }
 
-std::vector<BfOp> optimize_loop(const std::vector<BfOp>& ops, size_t loop_start) {
-    std::vector<BfOp> new_ops;
-
-    if (ops.size() - loop_start == 2) {
-        BfOp repeated_op = ops[loop_start + 1];
-        switch (repeated_op.kind) {
-        case BfOpKind::INC_DATA:
-        case BfOpKind::DEC_DATA:
-            new_ops.push_back(BfOp(BfOpKind::LOOP_SET_TO_ZERO, 0));
-            break;
-        case BfOpKind::INC_PTR:
-            new_ops.push_back(BfOp(BfOpKind::LOOP_MOVE_PTR, repeated_op.argument));
-            break;
-        case BfOpKind::DEC_PTR:
-            new_ops.push_back(BfOp(BfOpKind::LOOP_MOVE_PTR, -repeated_op.argument));
-            break;
-        default:
-            break;
-        }
-    } else if (ops.size() - loop_start == 5) {
-        if (ops[loop_start + 1].kind == BfOpKind::DEC_DATA
-                && ops[loop_start + 3].kind == BfOpKind::INC_DATA
-                && ops[loop_start + 1].argument == 1
-                && ops[loop_start + 3].argument == 1) {
-            if (ops[loop_start + 2].kind == BfOpKind::INC_PTR
-                    && ops[loop_start + 4].kind == BfOpKind::DEC_PTR
-                    && ops[loop_start + 2].argument == ops[loop_start + 4].argument) {
-                new_ops.push_back(BfOp(BfOpKind::LOOP_MOVE_DATA, ops[loop_start + 2].argument));
-            } else if (ops[loop_start + 2].kind == BfOpKind::DEC_PTR
-                    && ops[loop_start + 4].kind == BfOpKind::INC_PTR
-                    && ops[loop_start + 2].argument == ops[loop_start + 4].argument) {
-                new_ops.push_back(BfOp(BfOpKind::LOOP_MOVE_DATA, -ops[loop_start + 2].argument));
-            }
+// Picks the outermost loops that fit in registers, keyed by their '['.
+std::map<size_t, RegisterLoop> find_register_loops(const std::vector<BfOp>& ops) {
+    LoopTree tree = build_loop_tree(ops);
+    std::map<size_t, RegisterLoop> register_loops;
+
+    std::vector<size_t> pending(tree.roots.begin(), tree.roots.end());
+    while (!pending.empty()) {
+        const BfLoop& loop = tree.loops[pending.back()];
+        pending.pop_back();
+
+        RegisterLoop register_loop;
+        if (match_register_loop(ops, loop, &register_loop)) {
+            register_loops[loop.open] = register_loop;
+        } else {
+            pending.insert(pending.end(), loop.children.begin(), loop.children.end());
         }
     }
-    return new_ops;
+    return register_loops;
 }
 
-std::vector<BfOp> parse_bf_ops(const Program& p) {
+// Parsed ops per region; smaller programs are compiled in one piece.
+constexpr size_t OPT_ASMJIT_REGION_OPS = 1 << 14;
+
+// A piece of the program cut by split_top_level_regions, optimized and
+// emitted on its own. Its code expects the registers the prologue sets up
+// and falls through to the next region, so no jump leaves it.
+struct CompiledRegion {
     std::vector<BfOp> ops;
+    // Keyed by the pc of the loop's '['.
+    std::map<size_t, RegisterLoop> register_loops;
+    std::vector<PassTiming> pass_timings;
+    // Number of the region's first loop among all loops of the program.
+    size_t loop_base = 0;
+    std::vector<uint8_t> code;
+    // Relative to the start of code.
+    std::vector<JitSymbol> loop_symbols;
+};
 
-    size_t pc = 0;
+// Calls fn(i) for every i < count on up to jobs threads (0 for one per core).
+void parallel_for(size_t count, size_t jobs, const std::function<void(size_t)>& fn) {
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    jobs = std::min(jobs, count);
 
-    std::stack<size_t> loop_block_stack;
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            fn(i);
+        }
+    };
 
-    while (pc < p.instructions.size()) {
-        size_t repeated_count = calculate_repeated_insn_count(p, pc);
-        char insn = p.instructions[pc];
-        switch (insn) {
-            case '>':
-                ops.push_back(BfOp(BfOpKind::INC_PTR, repeated_count));
-                pc += repeated_count;
-                break;
-            case '<':
-                ops.push_back(BfOp(BfOpKind::DEC_PTR, repeated_count));
-                pc += repeated_count;
-                break;
-            case '+':
-                ops.push_back(BfOp(BfOpKind::INC_DATA, repeated_count));
-                pc += repeated_count;
-                break;
-            case '-':
-                ops.push_back(BfOp(BfOpKind::DEC_DATA, repeated_count));
-                pc += repeated_count;
-                break;
-            case '.':
-                ops.push_back(BfOp(BfOpKind::WRITE_STDOUT, repeated_count));
-                pc += repeated_count;
-                break;
-            case ',':
-                ops.push_back(BfOp(BfOpKind::READ_STDIN, repeated_count));
-                pc += repeated_count;
-                break;
-            case '[':
-                loop_block_stack.push(ops.size());
-                ops.push_back(BfOp(BfOpKind::JUMP_IF_DATA_ZERO, 0));
-                pc++;
-                break;
-            case ']':
-                {
-                    size_t loop_start = loop_block_stack.top();
-                    loop_block_stack.pop();
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < jobs; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
 
-                    std::vector<BfOp> optimized_loop = optimize_loop(ops, loop_start);
+// Cuts ops into regions and optimizes them on jobs threads. Only the first
+// region starts on a zeroed tape, and only if the ops start the program.
+// With verbose, prints each pass's time summed over all regions.
+std::vector<CompiledRegion> optimize_regions(const std::vector<BfOp>& ops, bool starts_program, size_t jobs,
+                                             bool verbose) {
+    std::vector<CompiledRegion> regions;
+    for (auto& region_ops : split_top_level_regions(ops, OPT_ASMJIT_REGION_OPS)) {
+        regions.emplace_back();
+        regions.back().ops.swap(region_ops);
+    }
 
-                    if (optimized_loop.empty()) {
-                        ops[loop_start].argument = ops.size();
-                        ops.push_back(BfOp(BfOpKind::JUMP_IF_DATA_NOT_ZERO, loop_start));
-                    } else {
-                        ops.erase(ops.begin() + loop_start, ops.end());
-                        ops.insert(ops.end(), optimized_loop.begin(), optimized_loop.end());
-                    }
-                    pc++;
-                }
-                break;
-            default:
-                std::cerr << "Fatal: bad char'" << insn << "'at pc=" << pc;
-                break;
+    parallel_for(regions.size(), jobs, [&](size_t i) {
+        PassManager pm = create_optimizing_pass_manager(starts_program && i == 0);
+        // The timings are printed once below rather than from each thread.
+        pm.run(regions[i].ops, false);
+        regions[i].pass_timings = pm.timings();
+        regions[i].register_loops = find_register_loops(regions[i].ops);
+    });
+
+    if (verbose && !regions.empty()) {
+        // Every region ran the same passes in the same order.
+        std::vector<PassTiming> totals = regions.front().pass_timings;
+        for (size_t i = 1; i < regions.size(); i++) {
+            for (size_t j = 0; j < totals.size(); j++) {
+                totals[j].seconds += regions[i].pass_timings[j].seconds;
+                totals[j].ops_after += regions[i].pass_timings[j].ops_after;
+            }
         }
+        print_pass_timings(totals, std::cout);
     }
 
+    // Loop counters are numbered across the whole program and optimizing
+    // turns some loops into single ops, so every region is optimized before
+    // any is emitted.
+    size_t loop_count = 0;
+    for (auto& region : regions) {
+        region.loop_base = loop_count;
+        loop_count += std::count_if(region.ops.begin(), region.ops.end(), [](const BfOp& op) {
+            return op.kind == BfOpKind::JUMP_IF_DATA_ZERO;
+        });
+    }
+    return regions;
+}
+
+// The ops of all regions as one program.
+std::vector<BfOp> join_region_ops(const std::vector<CompiledRegion>& regions) {
+    std::vector<BfOp> ops;
+    for (auto& region : regions) {
+        ops.insert(ops.end(), region.ops.begin(), region.ops.end());
+    }
+    link_jumps(ops);
     return ops;
 }
 
-void OptAsmjit::pre_execute_in_parsing_phase(const Program& p, bool verbose) {
-    this->bf_ops = parse_bf_ops(p);
+// All five are callee-saved, so they survive the calls into C helpers, and
+// pushing an odd number of them keeps rsp 16-byte aligned at those calls.
+struct JitRegisters {
+    asmjit::X86Gp scan = asmjit::x86::rbx;
+    asmjit::X86Gp dataptr = asmjit::x86::r13;
+    asmjit::X86Gp io = asmjit::x86::r12;
+    asmjit::X86Gp out_cur = asmjit::x86::r14;
+    asmjit::X86Gp out_end = asmjit::x86::r15;
+    asmjit::X86Mem io_out_cur = asmjit::x86::qword_ptr(io, offsetof(BfIo, out_cur));
+    asmjit::X86Mem io_out_end = asmjit::x86::qword_ptr(io, offsetof(BfIo, out_end));
+    // LoopProfile counters, with --loop-profile only.
+    asmjit::X86Gp loop_counters = asmjit::x86::rbp;
+};
+
+std::vector<uint8_t> finish_code(asmjit::CodeHolder& code, asmjit::X86Assembler& assm) {
+    if (assm.isInErrorState()) {
+        std::cerr << "asmjit error: " << asmjit::DebugUtils::errorAsString(assm.getLastError()) << "\n";
+        exit(1);
+    }
+
+    code.sync();
+    std::vector<uint8_t> bytes(code.getCodeSize());
+    if (code.relocate(bytes.data()) == 0) {
+        std::cerr << "Cannot emmit asm instructions\n";
+        exit(1);
+    }
+    return bytes;
 }
 
-void OptAsmjit::execute(const Program& p, bool verbose) {
-    asmjit::JitRuntime rt;
+// The start of void(uint8_t* memory, BfIo* io, void* scan_fn, uint64_t* loop_counters).
+std::vector<uint8_t> emit_prologue(const asmjit::CodeInfo& info, const Options& options) {
     asmjit::CodeHolder code;
-    code.init(rt.getCodeInfo());
+    code.init(info);
     asmjit::X86Assembler assm(&code);
+    JitRegisters regs;
+
+    assm.push(regs.scan);
+    assm.push(regs.io);
+    assm.push(regs.dataptr);
+    assm.push(regs.out_cur);
+    assm.push(regs.out_end);
+    if (options.loop_profile) {
+        // A sixth push needs another 8 bytes to keep the alignment.
+        assm.push(regs.loop_counters);
+        assm.sub(asmjit::x86::rsp, 8);
+        assm.mov(regs.loop_counters, asmjit::x86::rcx);
+    }
+    assm.mov(regs.dataptr, asmjit::x86::rdi);
+    assm.mov(regs.io, asmjit::x86::rsi);
+    assm.mov(regs.scan, asmjit::x86::rdx);
+    assm.mov(regs.out_cur, regs.io_out_cur);
+    assm.mov(regs.out_end, regs.io_out_end);
+    return finish_code(code, assm);
+}
 
-    asmjit::X86Gp dataptr = asmjit::x86::r13;
-    assm.mov(dataptr, asmjit::x86::rdi);
+std::vector<uint8_t> emit_epilogue(const asmjit::CodeInfo& info, const Options& options) {
+    asmjit::CodeHolder code;
+    code.init(info);
+    asmjit::X86Assembler assm(&code);
+    JitRegisters regs;
+
+    assm.mov(regs.io_out_cur, regs.out_cur);
+    if (options.loop_profile) {
+        assm.add(asmjit::x86::rsp, 8);
+        assm.pop(regs.loop_counters);
+    }
+    assm.pop(regs.out_end);
+    assm.pop(regs.out_cur);
+    assm.pop(regs.dataptr);
+    assm.pop(regs.io);
+    assm.pop(regs.scan);
+    assm.ret();
+    return finish_code(code, assm);
+}
+
+// Emits region->ops into region->code. Safe to call for several regions at
+// once.
+void emit_region(const asmjit::CodeInfo& info, const Options& options, const Program& p,
+                 CompiledRegion* region) {
+    asmjit::CodeHolder code;
+    code.init(info);
+    asmjit::X86Assembler assm(&code);
+    JitRegisters regs;
+
+    asmjit::X86Gp scan = regs.scan;
+    asmjit::X86Gp dataptr = regs.dataptr;
+    asmjit::X86Gp io = regs.io;
+    asmjit::X86Gp out_cur = regs.out_cur;
+    asmjit::X86Gp out_end = regs.out_end;
+    asmjit::X86Mem io_out_cur = regs.io_out_cur;
+    asmjit::X86Mem io_out_end = regs.io_out_end;
+    asmjit::X86Gp loop_counters = regs.loop_counters;
+    const std::vector<BfOp>& bf_ops = region->ops;
+    size_t loop_count = region->loop_base;
+
+    // Inside a register loop, its cells are loaded into these once at the
+    // '[' and stored back after the ']'. None of them are used elsewhere.
+    // All are caller-saved, so calls inside the loop spill them.
+    const asmjit::X86Gp cell_registers[CELL_REGISTER_COUNT] = {
+        asmjit::x86::rdx, asmjit::x86::rsi, asmjit::x86::rdi,
+        asmjit::x86::r8, asmjit::x86::r9, asmjit::x86::r10, asmjit::x86::r11,
+    };
+    std::map<int64_t, asmjit::X86Gp> cell_regs;
+    const RegisterLoop* current_register_loop = nullptr;
+
+    uint32_t cell_size = options.cell_width / 8;
+    auto cell_mem = [&](int64_t cell_offset) {
+        return asmjit::x86::ptr(dataptr, static_cast<int32_t>(cell_offset * cell_size), cell_size);
+    };
+    auto cell = [&](int64_t cell_offset) -> asmjit::Operand {
+        auto it = cell_regs.find(cell_offset);
+        if (it != cell_regs.end()) {
+            return cell_reg(it->second, cell_size);
+        }
+        return cell_mem(cell_offset);
+    };
+    // The low byte of a cell, which is all that is written out.
+    auto cell_byte = [&](int64_t cell_offset) -> asmjit::Operand {
+        auto it = cell_regs.find(cell_offset);
+        if (it != cell_regs.end()) {
+            return it->second.r8();
+        }
+        return asmjit::x86::byte_ptr(dataptr, static_cast<int32_t>(cell_offset * cell_size));
+    };
+    auto store_cell_registers = [&]() {
+        for (int64_t cell_offset : current_register_loop->written) {
+            assm.mov(cell_mem(cell_offset), cell_reg(cell_regs[cell_offset], cell_size));
+        }
+    };
+
+    // The output cursor lives in r14/r15 and is written back to io around
+    // every call into it, and so do the cells of a register loop.
+    auto emit_io_call = [&](int32_t fn) {
+        if (current_register_loop != nullptr) {
+            store_cell_registers();
+        }
+        assm.mov(io_out_cur, out_cur);
+        assm.mov(asmjit::x86::rdi, io);
+        assm.call(asmjit::x86::qword_ptr(io, fn));
+        assm.mov(out_cur, io_out_cur);
+        assm.mov(out_end, io_out_end);
+        if (current_register_loop != nullptr) {
+            for (int64_t cell_offset : current_register_loop->cells) {
+                load_cell(assm, cell_regs[cell_offset], cell_mem(cell_offset), cell_size);
+            }
+        }
+    };
+    // Truncates a constant to the cell width, keeping 64-bit ones signed so
+    // they fit the sign-extended imm32 forms.
+    auto cell_imm = [&](int64_t value) -> asmjit::Imm {
+        if (cell_size == 8) {
+            return asmjit::Imm(value);
+        }
+        return asmjit::Imm(value & ((int64_t(1) << options.cell_width) - 1));
+    };
 
     std::stack<BracketLabels> open_bracket_stack;
+    // Code offset of each open loop's first instruction.
+    std::stack<size_t> loop_starts;
 
     for (size_t pc = 0; pc < bf_ops.size(); pc++) {
-        BfOp op = bf_ops[pc];
+        const BfOp& op = bf_ops[pc];
         switch (op.kind) {
             case BfOpKind::INC_PTR:
-                assm.add(dataptr, op.argument);
+                assm.add(dataptr, op.argument * cell_size);
                 break;
             case BfOpKind::DEC_PTR:
-                assm.sub(dataptr, op.argument);
+                assm.sub(dataptr, op.argument * cell_size);
                 break;
             case BfOpKind::INC_DATA:
-                assm.add(asmjit::x86::byte_ptr(dataptr), op.argument);
+                assm.emit(asmjit::X86Inst::kIdAdd, cell(op.offset), cell_imm(op.argument));
                 break;
             case BfOpKind::DEC_DATA:
-                assm.sub(asmjit::x86::byte_ptr(dataptr), op.argument);
+                assm.emit(asmjit::X86Inst::kIdSub, cell(op.offset), cell_imm(op.argument));
                 break;
             case BfOpKind::READ_STDIN:
-                for (size_t i = 0; i < op.argument; i++) {
-                    assm.call(asmjit::imm_ptr(mygetchar));
-                    assm.mov(asmjit::x86::byte_ptr(dataptr), asmjit::x86::al);
+                for (int64_t i = 0; i < op.argument; i++) {
+                    emit_io_call(offsetof(BfIo, read_byte));
+                    assm.movzx(asmjit::x86::eax, asmjit::x86::al);
+                    assm.emit(asmjit::X86Inst::kIdMov, cell(op.offset), cell_reg(asmjit::x86::rax, cell_size));
                 }
                 break;
             case BfOpKind::WRITE_STDOUT:
-                for (size_t i = 0; i < op.argument; i++) {
-                    assm.movzx(asmjit::x86::rdi, asmjit::x86::byte_ptr(dataptr));
-                    assm.call(asmjit::imm_ptr(myputchar));
+                for (int64_t i = 0; i < op.argument; i++) {
+                    asmjit::Label done = assm.newLabel();
+                    assm.emit(asmjit::X86Inst::kIdMov, asmjit::x86::al, cell_byte(op.offset));
+                    assm.mov(asmjit::x86::byte_ptr(out_cur), asmjit::x86::al);
+                    assm.inc(out_cur);
+                    assm.cmp(out_cur, out_end);
+                    assm.jb(done);
+                    emit_io_call(offsetof(BfIo, flush));
+                    assm.bind(done);
                 }
                 break;
             case BfOpKind::LOOP_SET_TO_ZERO:
-                assm.mov(asmjit::x86::byte_ptr(dataptr), 0);
+                assm.emit(asmjit::X86Inst::kIdMov, cell(op.offset), asmjit::Imm(0));
+                break;
+            case BfOpKind::SET_DATA:
+                assm.emit(asmjit::X86Inst::kIdMov, cell(op.offset), cell_imm(op.argument));
                 break;
             case BfOpKind::LOOP_MOVE_PTR:
                 {
-                    asmjit::Label begin_label = assm.newLabel();
+                    // The scan is only worth a call if the loop is entered.
                     asmjit::Label end_label = assm.newLabel();
-                    assm.bind(begin_label);
-                    assm.cmp(asmjit::x86::byte_ptr(dataptr), 0);
-
+                    assm.emit(asmjit::X86Inst::kIdCmp, cell(0), asmjit::Imm(0));
                     assm.jz(end_label);
-                    if (op.argument < 0) {
-                        assm.sub(dataptr, -op.argument);
-                    } else {
-                        assm.add(dataptr, op.argument);
-                    }
-                    assm.jmp(begin_label);
+                    assm.mov(asmjit::x86::rdi, dataptr);
+                    assm.mov(asmjit::x86::rsi, op.argument);
+                    assm.call(scan);
+                    assm.mov(dataptr, asmjit::x86::rax);
                     assm.bind(end_label);
                 }
                 break;
             case BfOpKind::LOOP_MOVE_DATA:
-                {
-                    asmjit::Label skip_move = assm.newLabel();
-                    assm.cmp(asmjit::x86::byte_ptr(dataptr), 0);
-                    assm.jz(skip_move);
-
-                    assm.mov(asmjit::x86::r14, dataptr);
-                    if (op.argument < 0) {
-                      assm.sub(asmjit::x86::r14, -op.argument);
+                // Multiplying by a zero control cell adds nothing, so no
+                // branch is needed around the body.
+                load_cell(assm, asmjit::x86::rax, cell(op.offset), cell_size);
+                for (auto& t : op.targets) {
+                    asmjit::Operand target = cell(op.offset + t.offset);
+                    if (t.factor == 1) {
+                        assm.emit(asmjit::X86Inst::kIdAdd, target, cell_reg(asmjit::x86::rax, cell_size));
+                    } else if (t.factor == -1) {
+                        assm.emit(asmjit::X86Inst::kIdSub, target, cell_reg(asmjit::x86::rax, cell_size));
                     } else {
-                      assm.add(asmjit::x86::r14, op.argument);
+                        // The low bits of a product only depend on the low
+                        // bits of its factors.
+                        asmjit::X86Gp product = cell_size == 8 ? asmjit::x86::rcx : asmjit::x86::ecx;
+                        asmjit::X86Gp data = cell_size == 8 ? asmjit::x86::rax : asmjit::x86::eax;
+                        assm.imul(product, data, static_cast<int32_t>(t.factor));
+                        assm.emit(asmjit::X86Inst::kIdAdd, target, cell_reg(asmjit::x86::rcx, cell_size));
                     }
-                    assm.mov(asmjit::x86::rax, asmjit::x86::byte_ptr(dataptr));
-                    assm.add(asmjit::x86::byte_ptr(asmjit::x86::r14), asmjit::x86::al);
-                    assm.mov(asmjit::x86::byte_ptr(dataptr), 0);
-                    assm.bind(skip_move);
                 }
+                assm.emit(asmjit::X86Inst::kIdMov, cell(op.offset), asmjit::Imm(0));
                 break;
             case BfOpKind::JUMP_IF_DATA_ZERO:
                 {
-                    // cmpb $0, 0(%r13)
-                    assm.cmp(asmjit::x86::byte_ptr(dataptr), 0);
+                    auto it = region->register_loops.find(pc);
+                    if (current_register_loop == nullptr && it != region->register_loops.end()) {
+                        current_register_loop = &it->second;
+                        for (size_t i = 0; i < current_register_loop->cells.size(); i++) {
+                            int64_t cell_offset = current_register_loop->cells[i];
+                            load_cell(assm, cell_registers[i], cell_mem(cell_offset), cell_size);
+                            cell_regs[cell_offset] = cell_registers[i];
+                        }
+                    }
+
+                    // cmp $0, 0(%r13)
+                    loop_starts.push(assm.getOffset());
                     asmjit::Label open_label = assm.newLabel();
                     asmjit::Label close_label = assm.newLabel();
+                    if (!op.never_taken) {
+                        assm.emit(asmjit::X86Inst::kIdCmp, cell(0), asmjit::Imm(0));
+                        assm.jz(close_label);
+                    }
 
-                    assm.jz(close_label);
-
+                    // One increment on entry and one per iteration.
+                    if (options.loop_profile) {
+                        assm.inc(asmjit::x86::qword_ptr(loop_counters, static_cast<int32_t>(16 * loop_count)));
+                    }
                     assm.bind(open_label);
+                    if (options.loop_profile) {
+                        assm.inc(asmjit::x86::qword_ptr(loop_counters, static_cast<int32_t>(16 * loop_count + 8)));
+                    }
+                    loop_count++;
                     open_bracket_stack.push(BracketLabels(open_label, close_label));
                 }
                 break;
@@ -237,38 +473,154 @@ void OptAsmjit::execute(const Program& p, bool verbose) {
                     BracketLabels labels = open_bracket_stack.top();
                     open_bracket_stack.pop();
 
-                    assm.cmp(asmjit::x86::byte_ptr(dataptr), 0);
-                    assm.jnz(labels.open_label);
+                    // A loop that runs at most once is just a conditional.
+                    if (!op.never_taken) {
+                        assm.emit(asmjit::X86Inst::kIdCmp, cell(0), asmjit::Imm(0));
+                        assm.jnz(labels.open_label);
+                    }
                     assm.bind(labels.close_label);
+
+                    size_t start = loop_starts.top();
+                    loop_starts.pop();
+                    region->loop_symbols.push_back(JitSymbol{jit_loop_symbol(p.source_offset(bf_ops[op.argument].source)),
+                                                             start, assm.getOffset() - start});
+
+                    // Both ways out of the loop end up here, so this is the
+                    // only place its cells need to be written back.
+                    if (current_register_loop != nullptr && current_register_loop->close == pc) {
+                        store_cell_registers();
+                        cell_regs.clear();
+                        current_register_loop = nullptr;
+                    }
                 }
                 break;
             case BfOpKind::INVALID_OP:
             default:
-                std::cerr << "Fatal: Unknown op at pc=" << pc << "(" << op.kind << ")";
+                std::cerr << "Fatal: Unknown op at pc=" << pc << "(" << get_kind_str(op.kind) << ")";
                 exit(1);
         }
     }
 
-    assm.ret();
+    region->code = finish_code(code, assm);
+}
 
-    if (assm.isInErrorState()) {
-        std::cerr << "asmjit error: " << asmjit::DebugUtils::errorAsString(assm.getLastError()) << "\n";
-        exit(1);
+void OptAsmjit::pre_execute_in_parsing_phase(const Program& p, bool verbose) {
+    // Regions are optimized separately, so the prefix is evaluated on the
+    // unoptimized ops and only the rest is compiled. That is also all a
+    // cache entry holds; the prefix is evaluated again on a hit.
+    std::vector<BfOp> program_ops = parse_bf_ops(p);
+    if (options.partial_eval_steps > 0 && !options.loop_profile) {
+        prefix = evaluate_prefix(program_ops, options.cell_width, options.partial_eval_steps);
+        if (verbose) {
+            describe_prefix(prefix, program_ops.size(), std::cout);
+        }
+        program_ops = residual_ops(program_ops, prefix.resume_pc);
+        if (program_ops.empty()) {
+            // The program is its output.
+            return;
+        }
     }
 
-    using JittedFunc = void (*)(uint64_t);
+    CodeCache cache("opt_asmjit", p, options);
+    jit_program = cache.load();
+    if (jit_program && options.loop_profile) {
+        // The counters are numbered by the loops of the optimized IR, which
+        // a cache hit otherwise never builds.
+        std::vector<CompiledRegion> regions = optimize_regions(program_ops, true, options.compile_jobs, false);
+        loop_profile.reset(new LoopProfile(join_region_ops(regions)));
+    }
+    if (jit_program) {
+        if (verbose) {
+            std::cout << "Loaded " << jit_program->program_size() << " bytes of code from the cache\n";
+        }
+        jit_program->publish(options, {});
+        return;
+    }
 
-    JittedFunc func;
-    asmjit::Error err = rt.add(&func, &code);
-    if (err) {
-        std::cerr << "Cannot emmit asm instructions\n";
-        exit(1);
+    std::vector<BfOp> bf_ops;
+    std::vector<uint8_t> code = compile(p, program_ops, verbose, &bf_ops);
+    if (options.loop_profile) {
+        loop_profile.reset(new LoopProfile(bf_ops));
     }
+    cache.store(code);
+    jit_program.reset(new JitProgram(code));
+    jit_program->publish(options, loop_symbols);
+}
 
-    std::vector<uint8_t> memory(MEMORY_SIZE, 0);
-    func((uint64_t) memory.data());
+void OptAsmjit::execute(const Program& p, bool verbose) {
+    Tape tape;
+    {
+        StdIo stdio(options.async_io);
+        execute_on(p, tape.origin(), stdio.io());
+    }
 
+    if (loop_profile) {
+        loop_profile->report(p, std::cerr);
+    }
     std::cout << "successfully finished" << std::endl;
+}
+
+void OptAsmjit::execute_on(const Program& p, uint8_t* tape, BfIo* io) const {
+    tape = apply_prefix(prefix, tape, io);
+    if (!jit_program) {
+        return;
+    }
+
+    void* scan_fn = nullptr;
+    WITH_CELL_TYPE(options.cell_width,
+            scan_fn = reinterpret_cast<void*>(static_cast<Cell* (*)(Cell*, int64_t)>(scan_for_zero)));
 
-    rt.release(func);
+    using JittedFunc = void (*)(uint8_t*, BfIo*, void*, uint64_t*);
+    JittedFunc func = (JittedFunc)jit_program->program_memory();
+    func(tape, io, scan_fn, loop_profile ? loop_profile->counters() : nullptr);
+}
+
+// Emits void(uint8_t* memory, BfIo* io, void* scan_fn, uint64_t* loop_counters),
+// the last only used with --loop-profile. Helpers and counters are only
+// reached through the arguments and all jumps are relative, so the code is
+// position independent and can be cached.
+//
+// The program is cut at top-level loops into regions that are optimized
+// and emitted on options.compile_jobs threads, then laid out back to back
+// between a shared prologue and epilogue. The cuts don't depend on the
+// number of threads, so neither does the code.
+std::vector<uint8_t> OptAsmjit::compile(const Program& p, const std::vector<BfOp>& program_ops, bool verbose,
+                                        std::vector<BfOp>* ops) {
+    Timer optimize_timer;
+    // After a partially evaluated prefix the tape is no longer zeroed.
+    std::vector<CompiledRegion> regions =
+            optimize_regions(program_ops, prefix.resume_pc == 0, options.compile_jobs, verbose);
+    size_t register_loop_count = 0;
+    for (auto& region : regions) {
+        register_loop_count += region.register_loops.size();
+    }
+    double optimize_time = optimize_timer.elapsed();
+
+    Timer emit_timer;
+    asmjit::JitRuntime rt;
+    const asmjit::CodeInfo& info = rt.getCodeInfo();
+    parallel_for(regions.size(), options.compile_jobs, [&](size_t i) {
+        emit_region(info, options, p, &regions[i]);
+    });
+
+    std::vector<uint8_t> code = emit_prologue(info, options);
+    loop_symbols.clear();
+    for (auto& region : regions) {
+        for (auto& symbol : region.loop_symbols) {
+            symbol.offset += code.size();
+            loop_symbols.push_back(symbol);
+        }
+        code.insert(code.end(), region.code.begin(), region.code.end());
+    }
+    std::vector<uint8_t> epilogue = emit_epilogue(info, options);
+    code.insert(code.end(), epilogue.begin(), epilogue.end());
+    double emit_time = emit_timer.elapsed();
+
+    *ops = join_region_ops(regions);
+    if (verbose) {
+        std::cout << "Compiled " << regions.size() << " regions (" << ops->size() << " ops, "
+                  << register_loop_count << " register loops): optimize " << optimize_time
+                  << "s, emit " << emit_time << "s\n";
+    }
+    return code;
 }
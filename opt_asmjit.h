@@ -2,29 +2,21 @@
 #define OPT_ASMJIT_H
 
 #include "executor.h"
+#include "ir.h"
+#include "jit_utils.h"
+#include "loop_profile.h"
+#include "prefix_eval.h"
 
+#include <map>
+#include <memory>
 #include <vector>
 
-enum BfOpKind {
-    INVALID_OP = 0,
-    INC_PTR,
-    DEC_PTR,
-    INC_DATA,
-    DEC_DATA,
-    READ_STDIN,
-    WRITE_STDOUT,
-    LOOP_SET_TO_ZERO,
-    LOOP_MOVE_PTR,
-    LOOP_MOVE_DATA,
-    JUMP_IF_DATA_ZERO,
-    JUMP_IF_DATA_NOT_ZERO,
-};
-
-struct BfOp {
-    BfOp(BfOpKind kind, int64_t argument) : kind(kind), argument(argument) {};
-
-    BfOpKind kind = BfOpKind::INVALID_OP;
-    int64_t argument = 0;
+// A loop whose cells are all kept in registers from its '[' to its ']'.
+struct RegisterLoop {
+    size_t close = 0;
+    std::vector<int64_t> cells;
+    // Cells that have to be stored back when the loop exits.
+    std::vector<int64_t> written;
 };
 
 class OptAsmjit : public Executor {
@@ -32,9 +24,22 @@ public:
     OptAsmjit() {};
     void pre_execute_in_parsing_phase(const Program& p, bool verbose) override;
     void execute(const Program& p, bool verbose) override;
+    void execute_on(const Program& p, uint8_t* tape, BfIo* io) const override;
 
 private:
-    std::vector<BfOp> bf_ops;
+    // Null if --partial-eval ran the whole program.
+    std::unique_ptr<JitProgram> jit_program;
+    // What --partial-eval ran before the compiled code.
+    PrefixSnapshot prefix;
+    // Loops of the code compile() returned.
+    std::vector<JitSymbol> loop_symbols;
+    // Only with --loop-profile.
+    std::unique_ptr<LoopProfile> loop_profile;
+
+    // Compiles program_ops, all of p or what follows the prefix, and
+    // returns them optimized in ops.
+    std::vector<uint8_t> compile(const Program& p, const std::vector<BfOp>& program_ops, bool verbose,
+                                 std::vector<BfOp>* ops);
 };
 
 #endif
@@ -0,0 +1,63 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Budget of a bare --partial-eval.
+constexpr uint64_t DEFAULT_PARTIAL_EVAL_STEPS = 1 << 24;
+
+// Command line options shared by every executor.
+struct Options {
+    bool verbose = false;
+
+    // Run program I/O on separate reader/writer threads (--async-io).
+    bool async_io = false;
+
+    // Count entries and iterations of every loop in JIT code and report
+    // the hottest loops (--loop-profile). Not allowed with --batch.
+    bool loop_profile = false;
+
+    // Binary trace of every executed op, written by the Opt2 and Opt3
+    // interpreters and read by bf_trace (--trace=<file>).
+    std::string trace_path;
+
+    // Name JIT code for perf (--perf-map, --jitdump) and gdb (--gdb-jit).
+    bool perf_map = false;
+    bool jitdump = false;
+    bool gdb_jit = false;
+
+    // Report hardware performance counters per phase (--perf-counters).
+    bool perf_counters = false;
+
+    // Bits per tape cell: 8, 16, 32 or 64 (--cell-width=N).
+    int cell_width = 8;
+
+    // Threads compiling the regions of a large program in OptAsmjit; 0 uses
+    // every core (--compile-jobs=N).
+    size_t compile_jobs = 0;
+
+    // Ops the optimizing backends may run at compile time to get through
+    // the part of the program before its first read; 0 is off
+    // (--partial-eval[=N]). Not done with --trace or --loop-profile, which
+    // have to see the whole run.
+    uint64_t partial_eval_steps = 0;
+
+    // Directory of the persistent JIT code cache (--code-cache=<dir>).
+    std::string code_cache_dir;
+
+    // Run the program once per input file, in parallel, writing each
+    // output next to its input as <input>.out (--batch <program> <inputs...>).
+    bool batch = false;
+    // Worker threads for --batch; 0 uses every core (--jobs=N).
+    size_t batch_jobs = 0;
+    std::vector<std::string> batch_inputs;
+
+    // Superinstruction profile written by bf_superinsn, loaded by the
+    // threaded interpreter.
+    std::string superinsn_profile;
+};
+
+#endif
@@ -0,0 +1,552 @@
+#include "passes.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+
+void PassManager::add_pass(const std::string& name, BfPass pass) {
+    passes_.push_back(NamedPass{name, pass});
+}
+
+std::vector<BfOp> PassManager::run(const Program& p, bool verbose) {
+    timings_.clear();
+
+    Timer t;
+    std::vector<BfOp> ops = parse_bf_ops(p);
+    timings_.push_back(PassTiming{"parse", t.elapsed(), ops.size()});
+
+    run(ops, verbose);
+    return ops;
+}
+
+void PassManager::run(std::vector<BfOp>& ops, bool verbose) {
+    for (auto& p : passes_) {
+        Timer t;
+        p.pass(ops);
+        link_jumps(ops);
+        timings_.push_back(PassTiming{p.name, t.elapsed(), ops.size()});
+    }
+
+    if (verbose) {
+        print_pass_timings(timings_, std::cout);
+    }
+}
+
+void print_pass_timings(const std::vector<PassTiming>& timings, std::ostream& out) {
+    for (auto& timing : timings) {
+        out << "Pass " << timing.name << " took: " << timing.seconds << "s (" << timing.ops_after << " ops)\n";
+    }
+}
+
+PassManager create_basic_pass_manager() {
+    return PassManager();
+}
+
+PassManager create_optimizing_pass_manager(bool starts_program) {
+    PassManager pm;
+    pm.add_pass("loop-idioms", optimize_loop_idioms);
+    pm.add_pass("sink-pointer-moves", sink_pointer_moves);
+    pm.add_pass("fold-data-ops", fold_data_ops);
+    pm.add_pass("propagate-cell-values", [starts_program](std::vector<BfOp>& ops) {
+        propagate_cell_values(ops, starts_program);
+    });
+    return pm;
+}
+
+// Matches balanced loops made only of data and pointer increments whose
+// control cell steps by 1, e.g. [->>>+>>+<<<<<] or [->++<].
+bool match_multiply_loop(const std::vector<BfOp>& ops, size_t loop_start, size_t loop_end,
+                         std::vector<MulTarget>* targets) {
+    std::vector<MulTarget> deltas;
+    int64_t offset = 0;
+
+    for (size_t pc = loop_start + 1; pc < loop_end; pc++) {
+        const BfOp& op = ops[pc];
+        switch (op.kind) {
+            case BfOpKind::INC_PTR:
+                offset += op.argument;
+                break;
+            case BfOpKind::DEC_PTR:
+                offset -= op.argument;
+                break;
+            case BfOpKind::INC_DATA:
+            case BfOpKind::DEC_DATA:
+                {
+                    int64_t delta = op.kind == BfOpKind::INC_DATA ? op.argument : -op.argument;
+                    auto it = std::find_if(deltas.begin(), deltas.end(),
+                            [offset](const MulTarget& t) { return t.offset == offset; });
+                    if (it == deltas.end()) {
+                        deltas.push_back(MulTarget{offset, delta});
+                    } else {
+                        it->factor += delta;
+                    }
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+
+    if (offset != 0) {
+        return false;
+    }
+
+    auto control = std::find_if(deltas.begin(), deltas.end(),
+            [](const MulTarget& t) { return t.offset == 0; });
+    if (control == deltas.end() || (control->factor != -1 && control->factor != 1)) {
+        return false;
+    }
+
+    // A loop counting up runs (-data) times instead of data times.
+    int64_t sign = -control->factor;
+    targets->clear();
+    for (auto& t : deltas) {
+        if (t.offset != 0 && t.factor != 0) {
+            targets->push_back(MulTarget{t.offset, t.factor * sign});
+        }
+    }
+    return true;
+}
+
+std::vector<BfOp> optimize_loop(const std::vector<BfOp>& ops, size_t loop_start, size_t loop_end) {
+    std::vector<BfOp> new_ops;
+
+    if (loop_end - loop_start == 2) {
+        BfOp repeated_op = ops[loop_start + 1];
+        switch (repeated_op.kind) {
+        case BfOpKind::INC_DATA:
+        case BfOpKind::DEC_DATA:
+            new_ops.push_back(BfOp(BfOpKind::LOOP_SET_TO_ZERO, 0));
+            break;
+        case BfOpKind::INC_PTR:
+            new_ops.push_back(BfOp(BfOpKind::LOOP_MOVE_PTR, repeated_op.argument));
+            break;
+        case BfOpKind::DEC_PTR:
+            new_ops.push_back(BfOp(BfOpKind::LOOP_MOVE_PTR, -repeated_op.argument));
+            break;
+        default:
+            break;
+        }
+    } else {
+        std::vector<MulTarget> targets;
+        if (match_multiply_loop(ops, loop_start, loop_end, &targets)) {
+            BfOp op(BfOpKind::LOOP_MOVE_DATA, 0);
+            op.targets = targets;
+            new_ops.push_back(op);
+        }
+    }
+    return new_ops;
+}
+
+void optimize_loop_idioms(std::vector<BfOp>& ops) {
+    LoopTree tree = build_loop_tree(ops);
+    std::vector<BfOp> new_ops;
+
+    // Innermost loops never overlap, and the tree lists them in program order.
+    auto loop = tree.loops.begin();
+    size_t pc = 0;
+    while (pc < ops.size()) {
+        while (loop != tree.loops.end() && (loop->open < pc || !loop->children.empty())) {
+            ++loop;
+        }
+
+        if (loop != tree.loops.end() && loop->open == pc) {
+            std::vector<BfOp> optimized_loop = optimize_loop(ops, loop->open, loop->close);
+            if (!optimized_loop.empty()) {
+                new_ops.insert(new_ops.end(), optimized_loop.begin(), optimized_loop.end());
+                pc = loop->close + 1;
+                continue;
+            }
+        }
+
+        new_ops.push_back(ops[pc]);
+        pc++;
+    }
+
+    ops.swap(new_ops);
+}
+
+void sink_pointer_moves(std::vector<BfOp>& ops) {
+    std::vector<BfOp> new_ops;
+    int64_t pending = 0;
+
+    auto flush_pointer_move = [&]() {
+        if (pending > 0) {
+            new_ops.push_back(BfOp(BfOpKind::INC_PTR, pending));
+        } else if (pending < 0) {
+            new_ops.push_back(BfOp(BfOpKind::DEC_PTR, -pending));
+        }
+        pending = 0;
+    };
+
+    for (auto& op : ops) {
+        switch (op.kind) {
+            case BfOpKind::INC_PTR:
+                pending += op.argument;
+                break;
+            case BfOpKind::DEC_PTR:
+                pending -= op.argument;
+                break;
+            case BfOpKind::INC_DATA:
+            case BfOpKind::DEC_DATA:
+            case BfOpKind::READ_STDIN:
+            case BfOpKind::WRITE_STDOUT:
+            case BfOpKind::LOOP_SET_TO_ZERO:
+            case BfOpKind::SET_DATA:
+            case BfOpKind::LOOP_MOVE_DATA:
+                new_ops.push_back(op);
+                new_ops.back().offset += pending;
+                break;
+            default:
+                flush_pointer_move();
+                new_ops.push_back(op);
+                break;
+        }
+    }
+    // Kept even at the very end, where it has no effect on a whole
+    // program, so that regions split off by split_top_level_regions can be
+    // concatenated.
+    flush_pointer_move();
+
+    ops.swap(new_ops);
+}
+
+bool is_cell_write(const BfOp& op) {
+    return op.kind == BfOpKind::INC_DATA || op.kind == BfOpKind::DEC_DATA
+        || op.kind == BfOpKind::LOOP_SET_TO_ZERO || op.kind == BfOpKind::SET_DATA;
+}
+
+void fold_data_ops(std::vector<BfOp>& ops) {
+    std::vector<BfOp> new_ops;
+
+    for (auto& op : ops) {
+        if (!new_ops.empty() && is_cell_write(op) && is_cell_write(new_ops.back())
+                && new_ops.back().offset == op.offset) {
+            BfOp& prev = new_ops.back();
+            int64_t delta = op.kind == BfOpKind::DEC_DATA ? -op.argument : op.argument;
+
+            if (op.kind == BfOpKind::LOOP_SET_TO_ZERO || op.kind == BfOpKind::SET_DATA) {
+                // The later write overrides whatever prev did.
+                prev = op;
+            } else if (prev.kind == BfOpKind::LOOP_SET_TO_ZERO || prev.kind == BfOpKind::SET_DATA) {
+                prev.kind = BfOpKind::SET_DATA;
+                prev.argument += delta;
+            } else {
+                int64_t sum = (prev.kind == BfOpKind::DEC_DATA ? -prev.argument : prev.argument) + delta;
+                if (sum == 0) {
+                    new_ops.pop_back();
+                } else {
+                    prev.kind = sum > 0 ? BfOpKind::INC_DATA : BfOpKind::DEC_DATA;
+                    prev.argument = sum > 0 ? sum : -sum;
+                }
+            }
+            continue;
+        }
+        new_ops.push_back(op);
+    }
+
+    ops.swap(new_ops);
+}
+
+namespace {
+
+// What propagate_cell_values knows about a cell. Constants are tracked
+// modulo 2^64 because passes don't know the cell width: a constant only
+// counts as zero if it is 0 at every width, and as nonzero if its low byte
+// is, since that makes it nonzero at every width too.
+struct CellValue {
+    enum Kind { UNKNOWN, CONSTANT, NONZERO };
+
+    static CellValue unknown() {
+        return CellValue{UNKNOWN, 0};
+    }
+    static CellValue constant(uint64_t value) {
+        return CellValue{CONSTANT, value};
+    }
+    static CellValue nonzero() {
+        return CellValue{NONZERO, 0};
+    }
+
+    bool is_zero() const {
+        return kind == CONSTANT && value == 0;
+    }
+    bool is_nonzero() const {
+        return kind == NONZERO || (kind == CONSTANT && (value & 0xFF) != 0);
+    }
+    bool operator==(const CellValue& other) const {
+        return kind == other.kind && value == other.value;
+    }
+
+    Kind kind;
+    uint64_t value;
+};
+
+CellValue join(const CellValue& a, const CellValue& b) {
+    if (a == b) {
+        return a;
+    }
+    if (a.is_nonzero() && b.is_nonzero()) {
+        return CellValue::nonzero();
+    }
+    return CellValue::unknown();
+}
+
+// Only this many cells are tracked; past it everything is forgotten, which
+// keeps copying states at loops cheap.
+constexpr size_t MAX_TRACKED_CELLS = 256;
+
+// Cell values at one point of the program, keyed by their position relative
+// to where the data pointer was when tracking started.
+class CellState {
+public:
+    // The tape as the program starts: every cell zero.
+    static CellState zeroed() {
+        CellState state;
+        state.others_zero_ = true;
+        return state;
+    }
+
+    CellValue get(int64_t offset) const {
+        auto it = cells_.find(pos_ + offset);
+        if (it != cells_.end()) {
+            return it->second;
+        }
+        return others_zero_ ? CellValue::constant(0) : CellValue::unknown();
+    }
+
+    void set(int64_t offset, CellValue value) {
+        if (cells_.size() >= MAX_TRACKED_CELLS) {
+            forget_all();
+        }
+        cells_[pos_ + offset] = value;
+    }
+
+    void move(int64_t delta) {
+        pos_ += delta;
+    }
+
+    void forget_all() {
+        cells_.clear();
+        others_zero_ = false;
+    }
+
+    // Where two paths meet with the data pointer in the same place.
+    void join_with(const CellState& other) {
+        std::map<int64_t, CellValue> joined;
+        for (auto& cell : cells_) {
+            joined[cell.first] = join(cell.second, other.get(cell.first - pos_));
+        }
+        for (auto& cell : other.cells_) {
+            if (cells_.find(cell.first - other.pos_ + pos_) == cells_.end()) {
+                int64_t offset = cell.first - other.pos_;
+                joined[pos_ + offset] = join(get(offset), cell.second);
+            }
+        }
+        cells_.swap(joined);
+        others_zero_ = others_zero_ && other.others_zero_;
+    }
+
+private:
+    std::map<int64_t, CellValue> cells_;
+    bool others_zero_ = false;
+    int64_t pos_ = 0;
+};
+
+// Cells the loop [open, close] may write, relative to the data pointer at
+// its '['. Fails if the data pointer is not back where it was at the end of
+// every loop inside, or is moved by a scan, since then the cells can't be
+// named, and if there are more than MAX_TRACKED_CELLS of them, since
+// forgetting them would forget everything anyway.
+bool find_loop_writes(const std::vector<BfOp>& ops, size_t open, size_t close, std::set<int64_t>* writes) {
+    int64_t pos = 0;
+    std::vector<int64_t> loop_positions;
+
+    for (size_t pc = open; pc <= close; pc++) {
+        const BfOp& op = ops[pc];
+        switch (op.kind) {
+            case BfOpKind::INC_PTR:
+                pos += op.argument;
+                break;
+            case BfOpKind::DEC_PTR:
+                pos -= op.argument;
+                break;
+            case BfOpKind::INC_DATA:
+            case BfOpKind::DEC_DATA:
+            case BfOpKind::READ_STDIN:
+            case BfOpKind::LOOP_SET_TO_ZERO:
+            case BfOpKind::SET_DATA:
+                writes->insert(pos + op.offset);
+                break;
+            case BfOpKind::LOOP_MOVE_DATA:
+                writes->insert(pos + op.offset);
+                for (auto& t : op.targets) {
+                    writes->insert(pos + op.offset + t.offset);
+                }
+                break;
+            case BfOpKind::LOOP_MOVE_PTR:
+                return false;
+            case BfOpKind::JUMP_IF_DATA_ZERO:
+                loop_positions.push_back(pos);
+                break;
+            case BfOpKind::JUMP_IF_DATA_NOT_ZERO:
+                if (loop_positions.back() != pos) {
+                    return false;
+                }
+                loop_positions.pop_back();
+                break;
+            default:
+                break;
+        }
+        if (writes->size() > MAX_TRACKED_CELLS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Finding the cells a loop writes scans all of it, so loops nested deeper
+// than this are taken to write anything, which keeps deep nesting from
+// making the pass quadratic.
+constexpr size_t MAX_ANALYZED_LOOP_DEPTH = 256;
+
+// A loop propagate_ops is inside of.
+struct OpenLoop {
+    size_t close;
+    // Whether find_loop_writes could name the cells the loop writes.
+    bool fixed;
+    // The control cell at the '['.
+    CellValue control;
+    // The state at the '['.
+    CellState entry;
+};
+
+// Copies ops to out, updating state on the way. Open loops are kept on a
+// stack rather than the call stack, so any nesting depth works.
+void propagate_ops(const std::vector<BfOp>& ops, CellState state, std::vector<BfOp>& out) {
+    std::vector<OpenLoop> loops;
+    for (size_t pc = 0; pc < ops.size(); pc++) {
+        const BfOp& op = ops[pc];
+        if (!loops.empty() && pc == loops.back().close) {
+            OpenLoop& loop = loops.back();
+            out.push_back(op);
+            out.back().never_taken = state.get(0).is_zero();
+
+            // The loop is left either at the '[' or at the ']'.
+            CellState body = std::move(state);
+            state = std::move(loop.entry);
+            if (!loop.fixed) {
+                state.forget_all();
+            } else if (loop.control.is_nonzero()) {
+                state = std::move(body);
+            } else {
+                state.join_with(body);
+            }
+            state.set(0, CellValue::constant(0));
+            loops.pop_back();
+            continue;
+        }
+
+        CellValue cell = state.get(op.offset);
+        switch (op.kind) {
+            case BfOpKind::INC_PTR:
+                state.move(op.argument);
+                break;
+            case BfOpKind::DEC_PTR:
+                state.move(-op.argument);
+                break;
+            case BfOpKind::INC_DATA:
+            case BfOpKind::DEC_DATA:
+                if (cell.kind == CellValue::CONSTANT) {
+                    uint64_t delta = static_cast<uint64_t>(op.argument);
+                    state.set(op.offset, CellValue::constant(
+                            op.kind == BfOpKind::INC_DATA ? cell.value + delta : cell.value - delta));
+                } else {
+                    state.set(op.offset, CellValue::unknown());
+                }
+                break;
+            case BfOpKind::READ_STDIN:
+                state.set(op.offset, CellValue::unknown());
+                break;
+            case BfOpKind::WRITE_STDOUT:
+                break;
+            case BfOpKind::LOOP_SET_TO_ZERO:
+                if (cell.is_zero()) {
+                    continue;
+                }
+                state.set(op.offset, CellValue::constant(0));
+                break;
+            case BfOpKind::SET_DATA:
+                if (cell == CellValue::constant(op.argument)) {
+                    continue;
+                }
+                state.set(op.offset, CellValue::constant(op.argument));
+                break;
+            case BfOpKind::LOOP_MOVE_PTR:
+                if (state.get(0).is_zero()) {
+                    continue;
+                }
+                state.forget_all();
+                state.set(0, CellValue::constant(0));
+                break;
+            case BfOpKind::LOOP_MOVE_DATA:
+                if (cell.is_zero()) {
+                    continue;
+                }
+                for (auto& t : op.targets) {
+                    CellValue target = state.get(op.offset + t.offset);
+                    if (cell.kind == CellValue::CONSTANT && target.kind == CellValue::CONSTANT) {
+                        uint64_t product = cell.value * static_cast<uint64_t>(t.factor);
+                        state.set(op.offset + t.offset, CellValue::constant(target.value + product));
+                    } else {
+                        state.set(op.offset + t.offset, CellValue::unknown());
+                    }
+                }
+                state.set(op.offset, CellValue::constant(0));
+                break;
+            case BfOpKind::JUMP_IF_DATA_ZERO:
+                {
+                    size_t close = op.argument;
+                    CellValue control = state.get(0);
+                    if (control.is_zero()) {
+                        // Never entered.
+                        pc = close;
+                        continue;
+                    }
+
+                    // Every iteration starts from the state at the '[' with
+                    // the cells the loop writes forgotten.
+                    std::set<int64_t> writes;
+                    bool fixed = loops.size() < MAX_ANALYZED_LOOP_DEPTH &&
+                                 find_loop_writes(ops, pc, close, &writes);
+                    CellState body = state;
+                    if (fixed) {
+                        for (int64_t offset : writes) {
+                            body.set(offset, CellValue::unknown());
+                        }
+                    } else {
+                        body.forget_all();
+                    }
+                    body.set(0, CellValue::nonzero());
+
+                    out.push_back(op);
+                    out.back().never_taken = control.is_nonzero();
+                    loops.push_back(OpenLoop{close, fixed, control, std::move(state)});
+                    state = std::move(body);
+                }
+                continue;
+            default:
+                break;
+        }
+        out.push_back(op);
+    }
+}
+
+}  // namespace
+
+void propagate_cell_values(std::vector<BfOp>& ops, bool starts_program) {
+    std::vector<BfOp> new_ops;
+    propagate_ops(ops, starts_program ? CellState::zeroed() : CellState(), new_ops);
+    ops.swap(new_ops);
+}
@@ -0,0 +1,75 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include "ir.h"
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// A pass rewrites the op list in place. Jumps are relinked by the
+// PassManager after every pass, so passes may insert and erase ops freely.
+using BfPass = std::function<void(std::vector<BfOp>&)>;
+
+struct PassTiming {
+    std::string name;
+    double seconds;
+    size_t ops_after;
+};
+
+class PassManager {
+public:
+    PassManager() = default;
+
+    void add_pass(const std::string& name, BfPass pass);
+
+    // Parses p and runs all passes in the order they were added.
+    std::vector<BfOp> run(const Program& p, bool verbose);
+    void run(std::vector<BfOp>& ops, bool verbose);
+
+    const std::vector<PassTiming>& timings() const {
+        return timings_;
+    }
+
+private:
+    struct NamedPass {
+        std::string name;
+        BfPass pass;
+    };
+
+    std::vector<NamedPass> passes_;
+    std::vector<PassTiming> timings_;
+};
+
+// One "Pass <name> took: ..." line per timing, as run() prints them with
+// verbose set.
+void print_pass_timings(const std::vector<PassTiming>& timings, std::ostream& out);
+
+// Run-length parsing only.
+PassManager create_basic_pass_manager();
+// Everything the optimizing backends (Opt3, OptAsmjit) use. Pass
+// starts_program = false for ops that continue on a tape already in use,
+// such as all but the first of OptAsmjit's regions.
+PassManager create_optimizing_pass_manager(bool starts_program = true);
+
+// Replaces innermost loops matching a known idiom ([-], [>], [-<+>], ...)
+// with a single op.
+void optimize_loop_idioms(std::vector<BfOp>& ops);
+
+// Turns pointer moves into offsets on the data ops of each basic block and
+// emits one pointer move at the end of the block.
+void sink_pointer_moves(std::vector<BfOp>& ops);
+
+// Merges adjacent writes to the same cell, e.g. [-]+++ into SET_DATA 3.
+void fold_data_ops(std::vector<BfOp>& ops);
+
+// Tracks which cells are known to be zero, nonzero or a constant, starting
+// from the zeroed tape and the zero cell every loop leaves behind. Deletes
+// loops (and loop idioms) that are never entered and stores that change
+// nothing, and marks bracket ops whose jump can never happen: a '[' on a
+// cell known to be nonzero, or the ']' of a loop that runs at most once.
+// The tape is only assumed zeroed at the first op if starts_program.
+void propagate_cell_values(std::vector<BfOp>& ops, bool starts_program);
+
+#endif
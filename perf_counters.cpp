@@ -0,0 +1,134 @@
+#include "perf_counters.h"
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct PerfEvent {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+};
+
+constexpr uint64_t cache_miss(uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+const PerfEvent PERF_EVENTS[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"L1d-misses", PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D)},
+    {"LLC-misses", PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL)},
+    {"iTLB-misses", PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_ITLB)},
+};
+
+int open_perf_event(const PerfEvent& event) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = event.type;
+    attr.config = event.config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // The counters are not grouped, so the kernel may multiplex them; the
+    // times let read_perf_event scale the count up.
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+int64_t read_perf_event(int fd) {
+    uint64_t data[3];
+    if (read(fd, data, sizeof(data)) != sizeof(data) || data[2] == 0) {
+        return -1;
+    }
+    return static_cast<int64_t>(static_cast<double>(data[0]) * data[1] / data[2]);
+}
+
+PerfCounters::PerfCounters(bool enabled) : enabled_(enabled) {
+    if (!enabled_) {
+        return;
+    }
+
+    bool any = false;
+    for (auto& event : PERF_EVENTS) {
+        int fd = open_perf_event(event);
+        fds_.push_back(fd);
+        any |= fd >= 0;
+    }
+    if (!any) {
+        perror("perf_event_open");
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (int fd : fds_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+void PerfCounters::start() {
+    for (int fd : fds_) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void PerfCounters::stop(const std::string& name) {
+    if (!enabled_) {
+        return;
+    }
+
+    Phase phase;
+    phase.name = name;
+    for (int fd : fds_) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            phase.values.push_back(read_perf_event(fd));
+        } else {
+            phase.values.push_back(-1);
+        }
+    }
+    phases_.push_back(phase);
+}
+
+void PerfCounters::report(std::ostream& out) const {
+    if (!enabled_) {
+        return;
+    }
+
+    out << std::left << std::setw(10) << "phase" << std::right;
+    for (auto& event : PERF_EVENTS) {
+        out << std::setw(16) << event.name;
+    }
+    out << std::setw(8) << "IPC" << "\n";
+
+    for (auto& phase : phases_) {
+        out << std::left << std::setw(10) << phase.name << std::right;
+        for (int64_t value : phase.values) {
+            if (value < 0) {
+                out << std::setw(16) << "n/a";
+            } else {
+                out << std::setw(16) << value;
+            }
+        }
+        // cycles and instructions are the first two events.
+        if (phase.values[0] > 0 && phase.values[1] >= 0) {
+            out << std::setw(8) << std::fixed << std::setprecision(2)
+                << static_cast<double>(phase.values[1]) / phase.values[0];
+        } else {
+            out << std::setw(8) << "n/a";
+        }
+        out << "\n";
+    }
+}
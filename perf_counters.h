@@ -0,0 +1,41 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Hardware counters from perf_event_open (--perf-counters), read around
+// each phase of a run: cycles, instructions, branch misses, L1d and LLC
+// read misses and iTLB misses, counted in user space for this process and
+// the threads it starts afterwards. Counters the kernel or CPU won't
+// provide (see /proc/sys/kernel/perf_event_paranoid) are reported as n/a.
+class PerfCounters {
+public:
+    // Does nothing at all unless enabled.
+    explicit PerfCounters(bool enabled);
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    void start();
+    // Ends the phase started by start() and records it under name.
+    void stop(const std::string& name);
+
+    void report(std::ostream& out) const;
+
+private:
+    struct Phase {
+        std::string name;
+        // -1 where a counter is unavailable.
+        std::vector<int64_t> values;
+    };
+
+    bool enabled_;
+    std::vector<int> fds_;
+    std::vector<Phase> phases_;
+};
+
+#endif
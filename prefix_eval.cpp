@@ -0,0 +1,263 @@
+#include "prefix_eval.h"
+#include "bf_io.h"
+#include "cell.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+// Ops outside all loops, the '[' of a top-level loop included but not its
+// ']'. Each of them runs at most once, in order.
+std::vector<bool> find_top_level_ops(const std::vector<BfOp>& ops) {
+    std::vector<bool> top_level(ops.size());
+    size_t depth = 0;
+    for (size_t pc = 0; pc < ops.size(); pc++) {
+        top_level[pc] = depth == 0;
+        if (ops[pc].kind == BfOpKind::JUMP_IF_DATA_ZERO) {
+            depth++;
+        } else if (ops[pc].kind == BfOpKind::JUMP_IF_DATA_NOT_ZERO) {
+            depth--;
+        }
+    }
+    return top_level;
+}
+
+template <typename Cell>
+class PrefixEvaluator {
+public:
+    PrefixEvaluator(const std::vector<BfOp>& ops, const std::vector<bool>& top_level)
+        : ops_(ops), top_level_(top_level), cells_(1 << 12) {}
+
+    // Runs until the op outside all loops at stop_pc is next, the program
+    // ends, the next op reads input, max_steps ops have run or the next op
+    // would leave the tape window. Returns whether it stopped right before
+    // resume_pc(), the last op outside all loops it reached.
+    bool run(uint64_t max_steps, size_t stop_pc) {
+        for (;;) {
+            if (pc_ == ops_.size()) {
+                resume_pc_ = pc_;
+                return true;
+            }
+            if (top_level_[pc_]) {
+                resume_pc_ = pc_;
+                if (pc_ == stop_pc) {
+                    return true;
+                }
+            }
+            // step() changes nothing when it cannot run the op.
+            if (steps_ == max_steps || !step(ops_[pc_])) {
+                return top_level_[pc_];
+            }
+            steps_++;
+            pc_++;
+        }
+    }
+
+    size_t resume_pc() const {
+        return resume_pc_;
+    }
+
+    PrefixSnapshot snapshot() const {
+        PrefixSnapshot snapshot;
+        snapshot.resume_pc = resume_pc_;
+        snapshot.steps = steps_;
+        snapshot.output = output_;
+        snapshot.cell_bytes = sizeof(Cell);
+        snapshot.dataptr = dataptr_;
+
+        size_t begin = 0;
+        size_t end = cells_.size();
+        while (begin < end && cells_[begin] == 0) {
+            begin++;
+        }
+        while (end > begin && cells_[end - 1] == 0) {
+            end--;
+        }
+        snapshot.tape_begin = static_cast<int64_t>(begin) - origin_;
+        snapshot.tape.resize((end - begin) * sizeof(Cell));
+        if (end > begin) {
+            memcpy(snapshot.tape.data(), &cells_[begin], snapshot.tape.size());
+        }
+        return snapshot;
+    }
+
+private:
+    // Grows the window to hold cell index unless that would take more than
+    // PREFIX_EVAL_MAX_CELLS.
+    bool reach(int64_t index) {
+        int64_t i = origin_ + index;
+        int64_t size = cells_.size();
+        if (i >= 0 && i < size) {
+            return true;
+        }
+        int64_t needed = i < 0 ? size - i : i + 1;
+        if (needed > PREFIX_EVAL_MAX_CELLS) {
+            return false;
+        }
+        int64_t new_size = std::min(std::max(size * 2, needed), PREFIX_EVAL_MAX_CELLS);
+        // Growing to the left puts all the new cells before the old ones.
+        int64_t shift = i < 0 ? new_size - size : 0;
+        std::vector<Cell> grown(new_size);
+        std::copy(cells_.begin(), cells_.end(), grown.begin() + shift);
+        cells_.swap(grown);
+        origin_ += shift;
+        return true;
+    }
+
+    Cell& cell(int64_t index) {
+        return cells_[origin_ + index];
+    }
+
+    bool step(const BfOp& op) {
+        int64_t target = dataptr_ + op.offset;
+        switch (op.kind) {
+            case BfOpKind::INC_PTR:
+                dataptr_ += op.argument;
+                return true;
+            case BfOpKind::DEC_PTR:
+                dataptr_ -= op.argument;
+                return true;
+            case BfOpKind::INC_DATA:
+                if (!reach(target)) {
+                    return false;
+                }
+                cell(target) += op.argument;
+                return true;
+            case BfOpKind::DEC_DATA:
+                if (!reach(target)) {
+                    return false;
+                }
+                cell(target) -= op.argument;
+                return true;
+            case BfOpKind::WRITE_STDOUT:
+                if (!reach(target)) {
+                    return false;
+                }
+                output_.insert(output_.end(), op.argument, static_cast<uint8_t>(cell(target)));
+                return true;
+            case BfOpKind::LOOP_SET_TO_ZERO:
+                if (!reach(target)) {
+                    return false;
+                }
+                cell(target) = 0;
+                return true;
+            case BfOpKind::SET_DATA:
+                if (!reach(target)) {
+                    return false;
+                }
+                cell(target) = op.argument;
+                return true;
+            case BfOpKind::LOOP_MOVE_PTR:
+                {
+                    int64_t p = dataptr_;
+                    for (;;) {
+                        if (!reach(p)) {
+                            return false;
+                        }
+                        if (cell(p) == 0) {
+                            break;
+                        }
+                        p += op.argument;
+                    }
+                    dataptr_ = p;
+                }
+                return true;
+            case BfOpKind::LOOP_MOVE_DATA:
+                if (!reach(target)) {
+                    return false;
+                }
+                if (cell(target)) {
+                    for (auto& t : op.targets) {
+                        if (!reach(target + t.offset)) {
+                            return false;
+                        }
+                    }
+                    Cell data = cell(target);
+                    for (auto& t : op.targets) {
+                        cell(target + t.offset) += data * t.factor;
+                    }
+                    cell(target) = 0;
+                }
+                return true;
+            case BfOpKind::JUMP_IF_DATA_ZERO:
+                if (!reach(dataptr_)) {
+                    return false;
+                }
+                if (cell(dataptr_) == 0) {
+                    pc_ = op.argument;
+                }
+                return true;
+            case BfOpKind::JUMP_IF_DATA_NOT_ZERO:
+                if (!reach(dataptr_)) {
+                    return false;
+                }
+                if (cell(dataptr_) != 0) {
+                    pc_ = op.argument;
+                }
+                return true;
+            case BfOpKind::READ_STDIN:
+            default:
+                return false;
+        }
+    }
+
+    const std::vector<BfOp>& ops_;
+    const std::vector<bool>& top_level_;
+    size_t pc_ = 0;
+    size_t resume_pc_ = 0;
+    uint64_t steps_ = 0;
+    int64_t dataptr_ = 0;
+    // Cell i is cells_[origin_ + i].
+    std::vector<Cell> cells_;
+    int64_t origin_ = 0;
+    std::vector<uint8_t> output_;
+};
+
+template <typename Cell>
+PrefixSnapshot evaluate(const std::vector<BfOp>& ops, uint64_t max_steps) {
+    std::vector<bool> top_level = find_top_level_ops(ops);
+    PrefixEvaluator<Cell> evaluator(ops, top_level);
+    if (evaluator.run(max_steps, SIZE_MAX)) {
+        return evaluator.snapshot();
+    }
+
+    // Stopped inside a loop. Nothing before it read input, so running again
+    // up to the top-level op the loop started from gets there the same way.
+    PrefixEvaluator<Cell> replay(ops, top_level);
+    replay.run(UINT64_MAX, evaluator.resume_pc());
+    return replay.snapshot();
+}
+
+}  // namespace
+
+PrefixSnapshot evaluate_prefix(const std::vector<BfOp>& ops, int cell_width, uint64_t max_steps) {
+    WITH_CELL_TYPE(cell_width, return evaluate<Cell>(ops, max_steps));
+    return PrefixSnapshot();
+}
+
+std::vector<BfOp> residual_ops(const std::vector<BfOp>& ops, size_t from) {
+    std::vector<BfOp> residual(ops.begin() + from, ops.end());
+    link_jumps(residual);
+    return residual;
+}
+
+uint8_t* apply_prefix(const PrefixSnapshot& snapshot, uint8_t* tape, BfIo* io) {
+    bf_io_write(io, snapshot.output.data(), snapshot.output.size());
+    if (!snapshot.tape.empty()) {
+        memcpy(tape + snapshot.tape_begin * snapshot.cell_bytes, snapshot.tape.data(), snapshot.tape.size());
+    }
+    return tape + snapshot.dataptr * snapshot.cell_bytes;
+}
+
+void describe_prefix(const PrefixSnapshot& snapshot, size_t op_count, std::ostream& out) {
+    out << "Partial evaluation ran " << snapshot.steps << " ops and wrote " << snapshot.output.size()
+        << " bytes; ";
+    if (snapshot.resume_pc == op_count) {
+        out << "the program finished\n";
+    } else {
+        out << "resuming at op " << snapshot.resume_pc << " of " << op_count << " with "
+            << snapshot.tape.size() / snapshot.cell_bytes << " cells set\n";
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef PREFIX_EVAL_H
+#define PREFIX_EVAL_H
+
+#include "ir.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+struct BfIo;
+
+// Everything a program did before it first needs input, worked out at
+// compile time (--partial-eval): running the program afterwards is writing
+// output, storing the cells and running ops[resume_pc:] from dataptr.
+struct PrefixSnapshot {
+    // First op left to run; ops.size() if the program finished.
+    size_t resume_pc = 0;
+    // Ops evaluated to get there.
+    uint64_t steps = 0;
+    std::vector<uint8_t> output;
+    // The nonzero part of the tape, cell_bytes per cell, from cell
+    // tape_begin on.
+    int cell_bytes = 1;
+    int64_t tape_begin = 0;
+    std::vector<uint8_t> tape;
+    int64_t dataptr = 0;
+};
+
+// Runs ops (with linked jumps) on a zeroed tape of cell_width-bit cells
+// until the first READ_STDIN, until max_steps ops have run or until the
+// pointer leaves a window of PREFIX_EVAL_MAX_CELLS cells, and returns the
+// state before the last op outside all loops that it reached. Such an op
+// runs at most once, so the rest of the program is exactly
+// ops[resume_pc:].
+PrefixSnapshot evaluate_prefix(const std::vector<BfOp>& ops, int cell_width, uint64_t max_steps);
+
+constexpr int64_t PREFIX_EVAL_MAX_CELLS = int64_t(1) << 24;
+
+// ops[from:] with its jumps relinked. from must be outside all loops.
+std::vector<BfOp> residual_ops(const std::vector<BfOp>& ops, size_t from);
+
+// Writes the snapshot's output to io in one go and its cells to the zeroed
+// tape whose cell 0 is at tape. Returns where the residual program's cell 0
+// is.
+uint8_t* apply_prefix(const PrefixSnapshot& snapshot, uint8_t* tape, BfIo* io);
+
+// One line for --verbose.
+void describe_prefix(const PrefixSnapshot& snapshot, size_t op_count, std::ostream& out);
+
+#endif
@@ -0,0 +1,155 @@
+#include "program_loader.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <immintrin.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+inline bool is_command(char c) {
+    return c == '>' || c == '<' || c == '+' || c == '-' || c == '.' ||
+           c == ',' || c == '[' || c == ']';
+}
+
+// Where filtered instructions go, and the source offset the next one has if
+// it continues the current run.
+struct FilterOutput {
+    char* instructions;
+    size_t count;
+    size_t next_offset;
+    std::vector<SourceRun>* runs;
+};
+
+inline void append_command(const char* data, size_t i, FilterOutput* out) {
+    if (i != out->next_offset) {
+        out->runs->push_back(SourceRun{out->count, i});
+    }
+    out->instructions[out->count++] = data[i];
+    out->next_offset = i + 1;
+}
+
+// Appends the bytes of data[base, base + width) whose bit is set in mask.
+inline void append_masked(const char* data, size_t base, size_t width, uint32_t mask, FilterOutput* out) {
+    if (mask == static_cast<uint32_t>((uint64_t(1) << width) - 1) && base == out->next_offset) {
+        memcpy(out->instructions + out->count, data + base, width);
+        out->count += width;
+        out->next_offset += width;
+        return;
+    }
+    while (mask) {
+        append_command(data, base + __builtin_ctz(mask), out);
+        mask &= mask - 1;
+    }
+}
+
+void filter_tail(const char* data, size_t i, size_t size, FilterOutput* out) {
+    for (; i < size; i++) {
+        if (is_command(data[i])) {
+            append_command(data, i, out);
+        }
+    }
+}
+
+void filter_sse2(const char* data, size_t size, FilterOutput* out) {
+    const __m128i commands[8] = {
+        _mm_set1_epi8('>'), _mm_set1_epi8('<'), _mm_set1_epi8('+'), _mm_set1_epi8('-'),
+        _mm_set1_epi8('.'), _mm_set1_epi8(','), _mm_set1_epi8('['), _mm_set1_epi8(']'),
+    };
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i hits = _mm_cmpeq_epi8(chunk, commands[0]);
+        for (int c = 1; c < 8; c++) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, commands[c]));
+        }
+        append_masked(data, i, 16, _mm_movemask_epi8(hits), out);
+    }
+    filter_tail(data, i, size, out);
+}
+
+__attribute__((target("avx2")))
+void filter_avx2(const char* data, size_t size, FilterOutput* out) {
+    const __m256i commands[8] = {
+        _mm256_set1_epi8('>'), _mm256_set1_epi8('<'), _mm256_set1_epi8('+'), _mm256_set1_epi8('-'),
+        _mm256_set1_epi8('.'), _mm256_set1_epi8(','), _mm256_set1_epi8('['), _mm256_set1_epi8(']'),
+    };
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i hits = _mm256_cmpeq_epi8(chunk, commands[0]);
+        for (int c = 1; c < 8; c++) {
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, commands[c]));
+        }
+        append_masked(data, i, 32, _mm256_movemask_epi8(hits), out);
+    }
+    filter_tail(data, i, size, out);
+}
+
+using FilterKernel = void (*)(const char*, size_t, FilterOutput*);
+
+FilterKernel filter_kernel() {
+    static FilterKernel kernel = []() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? filter_avx2 : filter_sse2;
+    }();
+    return kernel;
+}
+
+}  // namespace
+
+Program parse_from_memory(const char* data, size_t size) {
+    Program program;
+    program.instructions.resize(size);
+    // The first command always starts a run.
+    FilterOutput out{&program.instructions[0], 0, SIZE_MAX, &program.source_runs};
+    filter_kernel()(data, size, &out);
+    program.instructions.resize(out.count);
+    program.instructions.shrink_to_fit();
+    return program;
+}
+
+Program load_program(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Fatal: Unable to open file " << path << std::endl;
+        exit(1);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size_t size = st.st_size;
+        void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            close(fd);
+            madvise(data, size, MADV_SEQUENTIAL);
+            Program program = parse_from_memory(static_cast<const char*>(data), size);
+            munmap(data, size);
+            return program;
+        }
+    }
+
+    std::string source;
+    char buffer[1 << 16];
+    for (;;) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0) {
+            perror("read");
+            exit(1);
+        }
+        if (n == 0) {
+            break;
+        }
+        source.append(buffer, n);
+    }
+    close(fd);
+    return parse_from_memory(source.data(), source.size());
+}
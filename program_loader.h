@@ -0,0 +1,18 @@
+#ifndef PROGRAM_LOADER_H
+#define PROGRAM_LOADER_H
+
+#include "executor.h"
+
+#include <cstddef>
+#include <string>
+
+// Keeps the eight command characters of a .bf source and where each came
+// from. Non-command bytes are dropped 16 or 32 at a time with SSE2 or AVX2,
+// picked at runtime from the CPU features.
+Program parse_from_memory(const char* data, size_t size);
+
+// Maps the file and parses it in place; pipes and other files that cannot
+// be mapped are read instead. Exits if the file cannot be opened.
+Program load_program(const std::string& path);
+
+#endif
@@ -0,0 +1,157 @@
+#include "scan.h"
+
+#include <immintrin.h>
+
+namespace {
+
+constexpr int64_t MAX_VECTOR_STRIDE = 16;
+
+// Bits 0, stride, 2*stride, ... set.
+uint64_t forward_pattern(int64_t stride) {
+    uint64_t pattern = 0;
+    for (int64_t i = 0; i < 64; i += stride) {
+        pattern |= 1ull << i;
+    }
+    return pattern;
+}
+
+// Bits 63, 63-stride, 63-2*stride, ... set.
+uint64_t backward_pattern(int64_t stride) {
+    uint64_t pattern = 0;
+    for (int64_t i = 63; i >= 0; i -= stride) {
+        pattern |= 1ull << i;
+    }
+    return pattern;
+}
+
+// `first` is the index of the lowest candidate cell inside a chunk of width
+// cells. Returns the index of the lowest candidate in the following chunk.
+inline unsigned next_forward_first(unsigned first, unsigned stride, unsigned width) {
+    unsigned last = first + stride * ((width - 1 - first) / stride);
+    return last + stride - width;
+}
+
+// `last` is the index of the highest candidate cell inside a chunk. Returns
+// the index of the highest candidate in the preceding chunk.
+inline unsigned next_backward_last(unsigned last, unsigned stride, unsigned width) {
+    return last % stride + width - stride;
+}
+
+uint8_t* scan_scalar(uint8_t* p, int64_t stride) {
+    while (*p) {
+        p += stride;
+    }
+    return p;
+}
+
+uint8_t* scan_forward_sse2(uint8_t* p, int64_t stride) {
+    const __m128i zero = _mm_setzero_si128();
+    const uint64_t pattern = forward_pattern(stride);
+
+    uint8_t* base = reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(p) & ~uintptr_t(15));
+    unsigned first = p - base;
+    for (;;) {
+        __m128i chunk = _mm_load_si128(reinterpret_cast<const __m128i*>(base));
+        uint32_t zeros = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+        uint32_t hits = zeros & static_cast<uint32_t>(pattern << first) & 0xFFFF;
+        if (hits) {
+            return base + __builtin_ctz(hits);
+        }
+        first = next_forward_first(first, stride, 16);
+        base += 16;
+    }
+}
+
+uint8_t* scan_backward_sse2(uint8_t* p, int64_t stride) {
+    const __m128i zero = _mm_setzero_si128();
+    const uint64_t pattern = backward_pattern(stride);
+
+    uint8_t* base = reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(p) & ~uintptr_t(15));
+    unsigned last = p - base;
+    for (;;) {
+        __m128i chunk = _mm_load_si128(reinterpret_cast<const __m128i*>(base));
+        uint32_t zeros = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+        uint32_t hits = zeros & static_cast<uint32_t>(pattern >> (63 - last)) & 0xFFFF;
+        if (hits) {
+            return base + 31 - __builtin_clz(hits);
+        }
+        last = next_backward_last(last, stride, 16);
+        base -= 16;
+    }
+}
+
+__attribute__((target("avx2")))
+uint8_t* scan_forward_avx2(uint8_t* p, int64_t stride) {
+    const __m256i zero = _mm256_setzero_si256();
+    const uint64_t pattern = forward_pattern(stride);
+
+    uint8_t* base = reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(p) & ~uintptr_t(31));
+    unsigned first = p - base;
+    for (;;) {
+        __m256i chunk = _mm256_load_si256(reinterpret_cast<const __m256i*>(base));
+        uint32_t zeros = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, zero));
+        uint32_t hits = zeros & static_cast<uint32_t>(pattern << first);
+        if (hits) {
+            return base + __builtin_ctz(hits);
+        }
+        first = next_forward_first(first, stride, 32);
+        base += 32;
+    }
+}
+
+__attribute__((target("avx2")))
+uint8_t* scan_backward_avx2(uint8_t* p, int64_t stride) {
+    const __m256i zero = _mm256_setzero_si256();
+    const uint64_t pattern = backward_pattern(stride);
+
+    uint8_t* base = reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(p) & ~uintptr_t(31));
+    unsigned last = p - base;
+    for (;;) {
+        __m256i chunk = _mm256_load_si256(reinterpret_cast<const __m256i*>(base));
+        uint32_t zeros = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, zero));
+        uint32_t hits = zeros & static_cast<uint32_t>(pattern >> (63 - last));
+        if (hits) {
+            return base + 31 - __builtin_clz(hits);
+        }
+        last = next_backward_last(last, stride, 32);
+        base -= 32;
+    }
+}
+
+using ScanKernel = uint8_t* (*)(uint8_t*, int64_t);
+
+struct ScanKernels {
+    ScanKernels() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            forward = scan_forward_avx2;
+            backward = scan_backward_avx2;
+        } else {
+            forward = scan_forward_sse2;
+            backward = scan_backward_sse2;
+        }
+    }
+
+    ScanKernel forward;
+    ScanKernel backward;
+};
+
+const ScanKernels& kernels() {
+    static ScanKernels k;
+    return k;
+}
+
+}  // namespace
+
+uint8_t* scan_for_zero(uint8_t* p, int64_t stride) {
+    if (*p == 0) {
+        return p;
+    }
+    if (stride > 0 && stride <= MAX_VECTOR_STRIDE) {
+        return kernels().forward(p, stride);
+    }
+    if (stride < 0 && stride >= -MAX_VECTOR_STRIDE) {
+        return kernels().backward(p, -stride);
+    }
+    return scan_scalar(p, stride);
+}
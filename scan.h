@@ -0,0 +1,24 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <cstdint>
+
+// Runs a LOOP_MOVE_PTR loop: starting at p, steps by stride (which may be
+// negative) until it reaches a zero cell and returns that cell.
+//
+// Strides up to 16 in either direction are searched 16 or 32 cells at a time
+// with SSE2 or AVX2, picked at runtime from the CPU features. The vector
+// kernels only issue aligned loads, so they never touch a page the scalar
+// loop would not have touched.
+uint8_t* scan_for_zero(uint8_t* p, int64_t stride);
+
+// Wider cells are scanned one at a time.
+template <typename Cell>
+Cell* scan_for_zero(Cell* p, int64_t stride) {
+    while (*p != 0) {
+        p += stride;
+    }
+    return p;
+}
+
+#endif
@@ -1,18 +1,13 @@
 #include "simple_asmjit.h"
+#include "bf_io.h"
+#include "tape.h"
 #include "jit_utils.h"
 #include "asmjit/asmjit.h"
+#include "asmjit_utils.h"
 
 #include <stack>
 #include <iostream>
 
-void myputchar(uint8_t c) {
-    putchar(c);
-}
-
-uint8_t mygetchar() {
-    return getchar();
-}
-
 class BracketLabels {
 public:
     BracketLabels(asmjit::Label open_label, asmjit::Label close_label)
@@ -22,16 +17,55 @@ public:
     const asmjit::Label close_label;
 };
 
+void SimpleAsmjit::pre_execute_in_parsing_phase(const Program& p, bool verbose) {
+    std::vector<uint8_t> code = emit_code(p);
+    jit_program.reset(new JitProgram(code));
+    jit_program->publish(options, {});
+}
+
 void SimpleAsmjit::execute(const Program& p, bool verbose) {
-    std::vector<uint8_t> memory(MEMORY_SIZE, 0);
+    Tape tape;
+    {
+        StdIo stdio(options.async_io);
+        execute_on(p, tape.origin(), stdio.io());
+    }
 
+    std::cout << "successfully finished" << std::endl;
+}
+
+void SimpleAsmjit::execute_on(const Program& p, uint8_t* tape, BfIo* io) const {
+    using JittedFunc = void (*)(uint8_t*, BfIo*);
+    JittedFunc func = (JittedFunc)jit_program->program_memory();
+    func(tape, io);
+}
+
+std::vector<uint8_t> SimpleAsmjit::emit_code(const Program& p) {
     asmjit::JitRuntime rt;
     asmjit::CodeHolder code;
     code.init(rt.getCodeInfo());
     asmjit::X86Assembler assm(&code);
 
+    // void(uint8_t* memory, BfIo* io). out_cur/out_end live in r14/r15 and
+    // are written back around every call into BfIo.
+    uint32_t cell_size = options.cell_width / 8;
     asmjit::X86Gp dataptr = asmjit::x86::r13;
+    asmjit::X86Mem cell = asmjit::x86::ptr(dataptr, 0, cell_size);
+    asmjit::X86Gp io = asmjit::x86::r12;
+    asmjit::X86Gp out_cur = asmjit::x86::r14;
+    asmjit::X86Gp out_end = asmjit::x86::r15;
+    asmjit::X86Mem io_out_cur = asmjit::x86::qword_ptr(io, offsetof(BfIo, out_cur));
+    asmjit::X86Mem io_out_end = asmjit::x86::qword_ptr(io, offsetof(BfIo, out_end));
+
+    // Five pushes keep the stack 16-byte aligned at calls.
+    assm.push(asmjit::x86::rbx);
+    assm.push(io);
+    assm.push(dataptr);
+    assm.push(out_cur);
+    assm.push(out_end);
     assm.mov(dataptr, asmjit::x86::rdi);
+    assm.mov(io, asmjit::x86::rsi);
+    assm.mov(out_cur, io_out_cur);
+    assm.mov(out_end, io_out_end);
 
     std::stack<BracketLabels> open_bracket_stack;
 
@@ -39,35 +73,53 @@ void SimpleAsmjit::execute(const Program& p, bool verbose) {
         char insn = p.instructions[pc];
         switch (insn) {
             case '>':
-                // inc %r13
-                assm.inc(dataptr);
+                // add $cell_size, %r13
+                assm.add(dataptr, cell_size);
                 break;
             case '<':
-                // dec %r13
-                assm.dec(dataptr);
+                // sub $cell_size, %r13
+                assm.sub(dataptr, cell_size);
                 break;
             case '+':
-                // addb $1, 0(%r13)
-                assm.add(asmjit::x86::byte_ptr(dataptr), 1);
+                // add $1, 0(%r13)
+                assm.add(cell, 1);
                 break;
             case '-':
-                // subb $1, 0(%r13)
-                assm.sub(asmjit::x86::byte_ptr(dataptr), 1);
+                // sub $1, 0(%r13)
+                assm.sub(cell, 1);
                 break;
             case '.':
-                // call myputchar [dataptr]
-                assm.movzx(asmjit::x86::rdi, asmjit::x86::byte_ptr(dataptr));
-                assm.call(asmjit::imm_ptr(myputchar));
+                {
+                    // *out_cur++ = low byte of [dataptr], calling io->flush
+                    // when full
+                    asmjit::Label done = assm.newLabel();
+                    assm.mov(asmjit::x86::al, asmjit::x86::byte_ptr(dataptr));
+                    assm.mov(asmjit::x86::byte_ptr(out_cur), asmjit::x86::al);
+                    assm.inc(out_cur);
+                    assm.cmp(out_cur, out_end);
+                    assm.jb(done);
+                    assm.mov(io_out_cur, out_cur);
+                    assm.mov(asmjit::x86::rdi, io);
+                    assm.call(asmjit::x86::qword_ptr(io, offsetof(BfIo, flush)));
+                    assm.mov(out_cur, io_out_cur);
+                    assm.mov(out_end, io_out_end);
+                    assm.bind(done);
+                }
                 break;
             case ',':
-                // [dataptr] = call mygetchar
-                assm.call(asmjit::imm_ptr(mygetchar));
-                assm.mov(asmjit::x86::byte_ptr(dataptr), asmjit::x86::al);
+                // [dataptr] = io->read_byte(io)
+                assm.mov(io_out_cur, out_cur);
+                assm.mov(asmjit::x86::rdi, io);
+                assm.call(asmjit::x86::qword_ptr(io, offsetof(BfIo, read_byte)));
+                assm.mov(out_cur, io_out_cur);
+                assm.mov(out_end, io_out_end);
+                assm.movzx(asmjit::x86::eax, asmjit::x86::al);
+                assm.mov(cell, cell_reg(asmjit::x86::rax, cell_size));
                 break;
             case '[':
                 {
-                    // cmpb $0, 0(%r13)
-                    assm.cmp(asmjit::x86::byte_ptr(dataptr), 0);
+                    // cmp $0, 0(%r13)
+                    assm.cmp(cell, 0);
                     asmjit::Label open_label = assm.newLabel();
                     asmjit::Label close_label = assm.newLabel();
 
@@ -86,7 +138,7 @@ void SimpleAsmjit::execute(const Program& p, bool verbose) {
                     BracketLabels labels = open_bracket_stack.top();
                     open_bracket_stack.pop();
 
-                    assm.cmp(asmjit::x86::byte_ptr(dataptr), 0);
+                    assm.cmp(cell, 0);
                     assm.jnz(labels.open_label);
                     assm.bind(labels.close_label);
                 }
@@ -96,6 +148,12 @@ void SimpleAsmjit::execute(const Program& p, bool verbose) {
         }
     }
 
+    assm.mov(io_out_cur, out_cur);
+    assm.pop(out_end);
+    assm.pop(out_cur);
+    assm.pop(dataptr);
+    assm.pop(io);
+    assm.pop(asmjit::x86::rbx);
     assm.ret();
 
     if (assm.isInErrorState()) {
@@ -103,16 +161,12 @@ void SimpleAsmjit::execute(const Program& p, bool verbose) {
         exit(1);
     }
 
-    using JittedFunc = void (*)(uint64_t);
-
-    JittedFunc func;
-    asmjit::Error err = rt.add(&func, &code);
-    if (err) {
+    code.sync();
+    std::vector<uint8_t> bytes(code.getCodeSize());
+    if (code.relocate(bytes.data()) == 0) {
         std::cerr << "Cannot emmit asm instructions\n";
         exit(1);
     }
-    func((uint64_t) memory.data());
-
-    std::cout << "successfully finished" << std::endl;
+    return bytes;
 }
 
@@ -2,12 +2,22 @@
 #define SIMPLE_ASMJIT_H
 
 #include "executor.h"
+#include "jit_utils.h"
+
+#include <memory>
+#include <vector>
 
 class SimpleAsmjit : public Executor {
 public:
     SimpleAsmjit() {};
-    void pre_execute_in_parsing_phase(const Program& p, bool verbose) override {};
+    void pre_execute_in_parsing_phase(const Program& p, bool verbose) override;
     void execute(const Program& p, bool verbose) override;
+    void execute_on(const Program& p, uint8_t* tape, BfIo* io) const override;
+
+private:
+    std::unique_ptr<JitProgram> jit_program;
+
+    std::vector<uint8_t> emit_code(const Program& p);
 };
 
 #endif
@@ -1,10 +1,23 @@
 #include "simple_interp.h"
+#include "bf_io.h"
+#include "cell.h"
+#include "tape.h"
 
 void SimpleInterpreter::execute(const Program& p, bool verbose) {
+    Tape tape;
+    StdIo stdio(options.async_io);
+    execute_on(p, tape.origin(), stdio.io());
+}
+
+void SimpleInterpreter::execute_on(const Program& p, uint8_t* tape, BfIo* io) const {
+    WITH_CELL_TYPE(options.cell_width, run(p, reinterpret_cast<Cell*>(tape), io));
+}
+
+template <typename Cell>
+void SimpleInterpreter::run(const Program& p, Cell* memory, BfIo* io) const {
     // Initialize state
-    std::vector<uint8_t> memory(MEMORY_SIZE, 0);
     size_t pc = 0;
-    size_t dataptr = 0;
+    int64_t dataptr = 0;
 
     while (pc < p.instructions.size()) {
         char insn = p.instructions[pc];
@@ -22,10 +35,10 @@ void SimpleInterpreter::execute(const Program& p, bool verbose) {
                 memory[dataptr]--;
                 break;
             case '.':
-                std::cout.put(memory[dataptr]);
+                bf_io_put(io, memory[dataptr]);
                 break;
             case ',':
-                memory[dataptr] = std::cin.get();
+                memory[dataptr] = bf_io_get(io);
                 break;
             case '[':
                 if (memory[dataptr] == 0) {
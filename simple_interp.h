@@ -2,6 +2,7 @@
 #define SIMPLE_INTERP_H
 
 #include "executor.h"
+#include "bf_io.h"
 #include <vector>
 #include <iostream>
 
@@ -10,6 +11,11 @@ public:
     SimpleInterpreter() {};
     void pre_execute_in_parsing_phase(const Program& p, bool verbose) override {};
     void execute(const Program& p, bool verbose) override;
+    void execute_on(const Program& p, uint8_t* tape, BfIo* io) const override;
+
+private:
+    template <typename Cell>
+    void run(const Program& p, Cell* memory, BfIo* io) const;
 };
 
 #endif
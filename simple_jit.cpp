@@ -1,71 +1,222 @@
 #include "simple_jit.h"
+#include "bf_io.h"
+#include "code_cache.h"
+#include "tape.h"
 #include "jit_utils.h"
 
 #include <stack>
 #include <iostream>
 
+constexpr uint8_t OUT_CUR = offsetof(BfIo, out_cur);
+constexpr uint8_t OUT_END = offsetof(BfIo, out_end);
+constexpr uint8_t FLUSH = offsetof(BfIo, flush);
+constexpr uint8_t READ_BYTE = offsetof(BfIo, read_byte);
+
+// Calls io->*fn(io) with the output cursor synced to memory.
+void emit_io_call(CodeEmitter* emitter, uint8_t fn) {
+    // mov %r14, OUT_CUR(%r12)
+    emitter->EmitBytes({0x4D, 0x89, 0x74, 0x24, OUT_CUR});
+    // mov %r12, %rdi
+    emitter->EmitBytes({0x4C, 0x89, 0xE7});
+    // call *fn(%r12)
+    emitter->EmitBytes({0x41, 0xFF, 0x54, 0x24, fn});
+    // mov OUT_CUR(%r12), %r14
+    emitter->EmitBytes({0x4D, 0x8B, 0x74, 0x24, OUT_CUR});
+    // mov OUT_END(%r12), %r15
+    emitter->EmitBytes({0x4D, 0x8B, 0x7C, 0x24, OUT_END});
+}
+
+// Emits "<op> $imm8, 0(%r13)" on a cell of cell_width bits. The ModRM byte
+// picks the op: 0x45 add, 0x6D sub, 0x7D cmp.
+void emit_cell_imm8(CodeEmitter* emitter, int cell_width, uint8_t modrm, uint8_t imm) {
+    if (cell_width == 16) {
+        // operand-size prefix
+        emitter->EmitByte(0x66);
+    }
+    // REX.B (+ REX.W for 64-bit cells)
+    emitter->EmitByte(cell_width == 64 ? 0x49 : 0x41);
+    // 0x80 is the byte form, 0x83 the sign-extended imm8 form of the others
+    emitter->EmitByte(cell_width == 8 ? 0x80 : 0x83);
+    emitter->EmitBytes({modrm, 0x00, imm});
+}
+
+// Where a loop's code begins: its cmp, its jz and the top of its body.
+struct LoopBlock {
+    size_t pc;
+    size_t start;
+    size_t jump_forward;
+    size_t body;
+};
+
+// incq disp32(%rbx), bumping a LoopProfile counter.
+void emit_count(CodeEmitter* emitter, size_t counter) {
+    emitter->EmitBytes({0x48, 0xFF, 0x83});
+    emitter->EmitUint32(counter * sizeof(uint64_t));
+}
+
+void SimpleJit::pre_execute_in_parsing_phase(const Program& p, bool verbose) {
+    if (options.loop_profile) {
+        loop_profile.reset(new LoopProfile(p));
+    }
+
+    CodeCache cache("simple_jit", p, options);
+    jit_program = cache.load();
+    if (jit_program) {
+        if (verbose) {
+            std::cout << "Loaded " << jit_program->program_size() << " bytes of code from the cache\n";
+        }
+        jit_program->publish(options, {});
+        return;
+    }
+
+    std::vector<uint8_t> code = emit_code(p);
+    cache.store(code);
+    jit_program.reset(new JitProgram(code));
+    jit_program->publish(options, loop_symbols);
+}
+
 void SimpleJit::execute(const Program& p, bool verbose) {
-    std::vector<uint8_t> memory(MEMORY_SIZE, 0);
+    Tape tape;
+    {
+        StdIo stdio(options.async_io);
+        execute_on(p, tape.origin(), stdio.io());
+    }
+
+    if (loop_profile) {
+        loop_profile->report(p, std::cerr);
+    }
+}
+
+void SimpleJit::execute_on(const Program& p, uint8_t* tape, BfIo* io) const {
+    using JittedFunc = void (*)(uint8_t*, BfIo*, uint64_t*);
+    JittedFunc func = (JittedFunc)jit_program->program_memory();
+    func(tape, io, loop_profile ? loop_profile->counters() : nullptr);
+}
+
+// Everything the code refers to outside itself goes through %r12, so it is
+// position independent and can be cached.
+std::vector<uint8_t> SimpleJit::emit_code(const Program& p) {
+    int cell_width = options.cell_width;
+    uint8_t cell_size = cell_width / 8;
 
     CodeEmitter emitter;
 
-    std::stack<size_t> loop_block_stack;
+    std::stack<LoopBlock> loop_block_stack;
+    size_t loop_count = 0;
+    loop_symbols.clear();
 
-    // movabs <address of memory.data>, %r13
-    emitter.EmitBytes({0x49, 0xBD});
-    emitter.EmitUint64((uint64_t)memory.data());
+    // The generated function is void(uint8_t* memory, BfIo* io,
+    // uint64_t* loop_counters). %r13 holds the data pointer, %r12 the BfIo,
+    // %r14/%r15 the output buffer cursor and end and, with --loop-profile,
+    // %rbx the counters. Five pushes keep the stack 16-byte aligned.
+    //
+    // push %rbx; push %r12; push %r13; push %r14; push %r15
+    emitter.EmitBytes({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+    // mov %rdi, %r13
+    emitter.EmitBytes({0x49, 0x89, 0xFD});
+    // mov %rsi, %r12
+    emitter.EmitBytes({0x49, 0x89, 0xF4});
+    // mov OUT_CUR(%r12), %r14
+    emitter.EmitBytes({0x4D, 0x8B, 0x74, 0x24, OUT_CUR});
+    // mov OUT_END(%r12), %r15
+    emitter.EmitBytes({0x4D, 0x8B, 0x7C, 0x24, OUT_END});
+    if (options.loop_profile) {
+        // mov %rdx, %rbx
+        emitter.EmitBytes({0x48, 0x89, 0xD3});
+    }
 
     for (size_t pc = 0; pc < p.instructions.size(); pc++) {
         char insn = p.instructions[pc];
         switch (insn) {
             case '>':
-                // inc %r13
-                emitter.EmitBytes({0x49, 0xFF, 0xC5});
+                if (cell_size == 1) {
+                    // inc %r13
+                    emitter.EmitBytes({0x49, 0xFF, 0xC5});
+                } else {
+                    // add $cell_size, %r13
+                    emitter.EmitBytes({0x49, 0x83, 0xC5, cell_size});
+                }
                 break;
             case '<':
-                // dec %r13
-                emitter.EmitBytes({0x49, 0xFF, 0xCD});
+                if (cell_size == 1) {
+                    // dec %r13
+                    emitter.EmitBytes({0x49, 0xFF, 0xCD});
+                } else {
+                    // sub $cell_size, %r13
+                    emitter.EmitBytes({0x49, 0x83, 0xED, cell_size});
+                }
                 break;
             case '+':
-                // addb $1, 0(%r13)
-                emitter.EmitBytes({0x41, 0x80, 0x45, 0x00, 0x01});
+                // add $1, 0(%r13)
+                emit_cell_imm8(&emitter, cell_width, 0x45, 0x01);
                 break;
             case '-':
-                // subb $1, 0(%r13)
-                emitter.EmitBytes({0x41, 0x80, 0x6D, 0x00, 0x01});
+                // sub $1, 0(%r13)
+                emit_cell_imm8(&emitter, cell_width, 0x6D, 0x01);
                 break;
             case '.':
-                // To emit one byte to stdout, call the write syscall with fd=1 (for
-                // stdout), buf=address of byte, count=1.
-                //
-                // mov $1, %rax
-                // mov $1, %rdi
-                // mov %r13, %rsi
-                // mov $1, %rdx
-                // syscall
-                emitter.EmitBytes({0x48, 0xC7, 0xC0, 0x01, 0x00, 0x00, 0x00});
-                emitter.EmitBytes({0x48, 0xC7, 0xC7, 0x01, 0x00, 0x00, 0x00});
-                emitter.EmitBytes({0x4C, 0x89, 0xEE});
-                emitter.EmitBytes({0x48, 0xC7, 0xC2, 0x01, 0x00, 0x00, 0x00});
-                emitter.EmitBytes({0x0F, 0x05});
+                {
+                    // Append the byte to the output buffer and only call
+                    // io->flush when it is full.
+                    //
+                    // mov 0(%r13), %al (the low byte of any cell)
+                    emitter.EmitBytes({0x41, 0x8A, 0x45, 0x00});
+                    // mov %al, (%r14)
+                    emitter.EmitBytes({0x41, 0x88, 0x06});
+                    // inc %r14
+                    emitter.EmitBytes({0x49, 0xFF, 0xC6});
+                    // cmp %r15, %r14
+                    emitter.EmitBytes({0x4D, 0x39, 0xFE});
+                    // jb <past the flush call>
+                    emitter.EmitBytes({0x72, 0x00});
+                    size_t skip_from = emitter.size();
+                    emit_io_call(&emitter, FLUSH);
+                    emitter.ReplaceByteAtOffset(skip_from - 1, emitter.size() - skip_from);
+                }
                 break;
             case ',':
-                // To read one byte from stdin, call the read syscall with fd=0 (for
-                // stdin),
-                // buf=address of byte, count=1.
-                emitter.EmitBytes({0x48, 0xC7, 0xC0, 0x00, 0x00, 0x00, 0x00});
-                emitter.EmitBytes({0x48, 0xC7, 0xC7, 0x00, 0x00, 0x00, 0x00});
-                emitter.EmitBytes({0x4C, 0x89, 0xEE});
-                emitter.EmitBytes({0x48, 0xC7, 0xC2, 0x01, 0x00, 0x00, 0x00});
-                emitter.EmitBytes({0x0F, 0x05});
+                // [dataptr] = io->read_byte(io)
+                emit_io_call(&emitter, READ_BYTE);
+                if (cell_width == 8) {
+                    // mov %al, 0(%r13)
+                    emitter.EmitBytes({0x41, 0x88, 0x45, 0x00});
+                } else {
+                    // movzx %al, %eax (also clears the upper half of %rax)
+                    emitter.EmitBytes({0x0F, 0xB6, 0xC0});
+                    if (cell_width == 16) {
+                        // mov %ax, 0(%r13)
+                        emitter.EmitBytes({0x66, 0x41, 0x89, 0x45, 0x00});
+                    } else if (cell_width == 32) {
+                        // mov %eax, 0(%r13)
+                        emitter.EmitBytes({0x41, 0x89, 0x45, 0x00});
+                    } else {
+                        // mov %rax, 0(%r13)
+                        emitter.EmitBytes({0x49, 0x89, 0x45, 0x00});
+                    }
+                }
                 break;
             case '[':
-                // cmpb $0, 0(%r13)
-                emitter.EmitBytes({0x41, 0x80, 0x7d, 0x00, 0x00});
-                loop_block_stack.push(emitter.size());
-                // jz <place holder 0>
-                emitter.EmitBytes({0x0F, 0x84});
-                emitter.EmitUint32(0);
+                {
+                    LoopBlock block;
+                    block.pc = pc;
+                    block.start = emitter.size();
+                    // cmp $0, 0(%r13)
+                    emit_cell_imm8(&emitter, cell_width, 0x7D, 0x00);
+                    block.jump_forward = emitter.size();
+                    // jz <place holder 0>
+                    emitter.EmitBytes({0x0F, 0x84});
+                    emitter.EmitUint32(0);
+
+                    if (options.loop_profile) {
+                        emit_count(&emitter, 2 * loop_count);
+                        block.body = emitter.size();
+                        emit_count(&emitter, 2 * loop_count + 1);
+                    } else {
+                        block.body = emitter.size();
+                    }
+                    loop_count++;
+                    loop_block_stack.push(block);
+                }
                 break;
             case ']':
                 {
@@ -73,23 +224,26 @@ void SimpleJit::execute(const Program& p, bool verbose) {
                         std::cerr << "Unmatched closing ']' at pc=" << pc;
                         exit(1);
                     }
-                    size_t loop_start = loop_block_stack.top();
+                    LoopBlock block = loop_block_stack.top();
                     loop_block_stack.pop();
 
-                    // cmpb $0, 0(%r13)
-                    emitter.EmitBytes({0x41, 0x80, 0x7d, 0x00, 0x00});
+                    // cmp $0, 0(%r13)
+                    emit_cell_imm8(&emitter, cell_width, 0x7D, 0x00);
                     size_t jump_back_from = emitter.size() + 6;
-                    size_t jump_back_to = loop_start + 6;
+                    size_t jump_back_to = block.body;
                     uint32_t pcrel_offset_back = compute_relative_32bit_offset(jump_back_from, jump_back_to);
 
-                    // jnz <loop_start location>
+                    // jnz <loop body>
                     emitter.EmitBytes({0x0F, 0x85});
                     emitter.EmitUint32(pcrel_offset_back);
 
-                    size_t jump_forward_from = loop_start + 6;
+                    size_t jump_forward_from = block.jump_forward + 6;
                     size_t jump_forward_to = emitter.size();
                     uint32_t pcrel_offset_forward = compute_relative_32bit_offset(jump_forward_from, jump_forward_to);
-                    emitter.ReplaceUint32AtOffset(loop_start + 2, pcrel_offset_forward);
+                    emitter.ReplaceUint32AtOffset(block.jump_forward + 2, pcrel_offset_forward);
+
+                    loop_symbols.push_back(JitSymbol{jit_loop_symbol(p.source_offset(block.pc)), block.start,
+                                                     emitter.size() - block.start});
                 }
                 break;
             default:
@@ -97,13 +251,13 @@ void SimpleJit::execute(const Program& p, bool verbose) {
         }
     }
 
+    // mov %r14, OUT_CUR(%r12)
+    emitter.EmitBytes({0x4D, 0x89, 0x74, 0x24, OUT_CUR});
+    // pop %r15; pop %r14; pop %r13; pop %r12; pop %rbx
+    emitter.EmitBytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B});
+    // ret
     emitter.EmitByte(0xC3);
 
-    std::vector<uint8_t> emitted_code = emitter.code();
-    JitProgram jit_program(emitted_code);
-
-    using JittedFunc = void (*)(void);
-    JittedFunc func = (JittedFunc)jit_program.program_memory();
-    func();
+    return emitter.code();
 }
 
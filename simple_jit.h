@@ -2,12 +2,27 @@
 #define SIMPLE_JIT_H
 
 #include "executor.h"
+#include "jit_utils.h"
+#include "loop_profile.h"
+
+#include <memory>
+#include <vector>
 
 class SimpleJit : public Executor {
 public:
     SimpleJit() {};
-    void pre_execute_in_parsing_phase(const Program& p, bool verbose) override {};
+    void pre_execute_in_parsing_phase(const Program& p, bool verbose) override;
     void execute(const Program& p, bool verbose) override;
+    void execute_on(const Program& p, uint8_t* tape, BfIo* io) const override;
+
+private:
+    std::vector<uint8_t> emit_code(const Program& p);
+
+    std::unique_ptr<JitProgram> jit_program;
+    // Loops of the code emit_code() returned.
+    std::vector<JitSymbol> loop_symbols;
+    // Only with --loop-profile.
+    std::unique_ptr<LoopProfile> loop_profile;
 };
 
 #endif
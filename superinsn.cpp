@@ -0,0 +1,57 @@
+#include "superinsn.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+bool is_superinsn_candidate(BfOpKind first, BfOpKind second) {
+#define SUPERINSN_MATCH_PAIR(A, B) \
+    if (first == BfOpKind::A && second == BfOpKind::B) { \
+        return true; \
+    }
+#define SUPERINSN_MATCH_ROW(A) SUPERINSN_SECOND_KINDS(SUPERINSN_MATCH_PAIR, A)
+    SUPERINSN_FIRST_KINDS(SUPERINSN_MATCH_ROW)
+#undef SUPERINSN_MATCH_ROW
+#undef SUPERINSN_MATCH_PAIR
+    return false;
+}
+
+void write_superinsn_profile(const std::vector<SuperInsn>& superinsns, std::ostream& out) {
+    out << "# bf-jit superinstruction profile: <count> <first op> <second op>\n";
+    for (auto& s : superinsns) {
+        out << s.count << " " << get_kind_str(s.first) << " " << get_kind_str(s.second) << "\n";
+    }
+}
+
+std::vector<SuperInsn> load_superinsn_profile(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Fatal: Unable to open superinstruction profile " << path << std::endl;
+        exit(1);
+    }
+
+    std::vector<SuperInsn> superinsns;
+    size_t line_no = 0;
+    for (std::string line; std::getline(file, line);) {
+        line_no++;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        SuperInsn s;
+        std::string first, second;
+        if (!(fields >> s.count >> first >> second)) {
+            std::cerr << "Fatal: Malformed superinstruction profile line " << line_no << std::endl;
+            exit(1);
+        }
+        s.first = get_kind_from_str(first);
+        s.second = get_kind_from_str(second);
+
+        // Profiles may come from a newer build; skip pairs we cannot fuse.
+        if (is_superinsn_candidate(s.first, s.second)) {
+            superinsns.push_back(s);
+        }
+    }
+    return superinsns;
+}
@@ -0,0 +1,49 @@
+#ifndef SUPERINSN_H
+#define SUPERINSN_H
+
+#include "ir.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Op pairs the threaded interpreter has fused handlers for. The first op
+// must be straight-line code without I/O; the second may also be a jump.
+#define SUPERINSN_FIRST_KINDS(X) \
+    X(INC_PTR) \
+    X(DEC_PTR) \
+    X(INC_DATA) \
+    X(DEC_DATA) \
+    X(LOOP_SET_TO_ZERO) \
+    X(SET_DATA) \
+    X(LOOP_MOVE_PTR) \
+    X(LOOP_MOVE_DATA)
+
+#define SUPERINSN_SECOND_KINDS(X, FIRST) \
+    X(FIRST, INC_PTR) \
+    X(FIRST, DEC_PTR) \
+    X(FIRST, INC_DATA) \
+    X(FIRST, DEC_DATA) \
+    X(FIRST, LOOP_SET_TO_ZERO) \
+    X(FIRST, SET_DATA) \
+    X(FIRST, LOOP_MOVE_PTR) \
+    X(FIRST, LOOP_MOVE_DATA) \
+    X(FIRST, JUMP_IF_DATA_ZERO) \
+    X(FIRST, JUMP_IF_DATA_NOT_ZERO)
+
+// One dynamically adjacent op pair and how often it was executed.
+struct SuperInsn {
+    BfOpKind first;
+    BfOpKind second;
+    uint64_t count;
+};
+
+bool is_superinsn_candidate(BfOpKind first, BfOpKind second);
+
+// Profile files hold one "<count> <FIRST_KIND> <SECOND_KIND>" line per pair,
+// most frequent first. Lines starting with '#' are comments.
+void write_superinsn_profile(const std::vector<SuperInsn>& superinsns, std::ostream& out);
+std::vector<SuperInsn> load_superinsn_profile(const std::string& path);
+
+#endif
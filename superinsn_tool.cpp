@@ -0,0 +1,128 @@
+// bf_superinsn: runs a corpus of programs over the optimized IR, counts how
+// often each fusable op pair executes back to back, and writes the most
+// frequent pairs as a profile for `bf_threaded --superinsns=<profile>`.
+//
+// Programs run in the Opt3 interpreter's loop, on the same optimized IR the
+// threaded interpreter fuses.
+//
+// Usage: bf_superinsn [--top=N] [--cell-width=N] <profile-out> <program.bf>[,<stdin-file>]...
+
+#include "bf_io.h"
+#include "cell.h"
+#include "opt3_interp.h"
+#include "passes.h"
+#include "program_loader.h"
+#include "superinsn.h"
+#include "tape.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+using PairCounts = std::vector<std::vector<uint64_t>>;
+
+// Counts ops that run back to back, as a tracer for run_opt3_ops. Only
+// straight-line ops without I/O can start a pair, so after one of those the
+// next op recorded is always the one at the following pc.
+class PairCounter {
+public:
+    explicit PairCounter(PairCounts* counts) : counts_(counts) {}
+
+    void record(size_t pc, BfOpKind kind, int64_t dataptr) {
+        (*counts_)[static_cast<size_t>(prev_kind_)][static_cast<size_t>(kind)]++;
+        switch (kind) {
+            case BfOpKind::WRITE_STDOUT:
+            case BfOpKind::READ_STDIN:
+            case BfOpKind::JUMP_IF_DATA_ZERO:
+            case BfOpKind::JUMP_IF_DATA_NOT_ZERO:
+                prev_kind_ = BfOpKind::INVALID_OP;
+                break;
+            default:
+                prev_kind_ = kind;
+                break;
+        }
+    }
+
+private:
+    PairCounts* counts_;
+    BfOpKind prev_kind_ = BfOpKind::INVALID_OP;
+};
+
+int main(int argc, const char** argv) {
+    size_t top = 16;
+    int cell_width = 8;
+    int arg_i = 1;
+    std::string value;
+    for (; arg_i < argc && std::string(argv[arg_i]).compare(0, 2, "--") == 0; arg_i++) {
+        if (match_flag_value(argv[arg_i], "--top", &value)) {
+            top = std::stoul(value);
+        } else if (match_flag_value(argv[arg_i], "--cell-width", &value)) {
+            cell_width = std::atoi(value.c_str());
+        } else {
+            std::cerr << "Unknown flag " << argv[arg_i] << std::endl;
+            exit(1);
+        }
+    }
+
+    if (argc - arg_i < 2) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--top=N] [--cell-width=N] <profile-out> <program.bf>[,<stdin-file>]...\n";
+        exit(1);
+    }
+    std::string profile_path = argv[arg_i++];
+
+    PairCounts counts(BF_OP_KIND_COUNT, std::vector<uint64_t>(BF_OP_KIND_COUNT, 0));
+    for (; arg_i < argc; arg_i++) {
+        std::string spec = argv[arg_i];
+        std::string bf_file_path = spec.substr(0, spec.find(','));
+        std::string input_path = spec.find(',') == std::string::npos ? "" : spec.substr(spec.find(',') + 1);
+
+        Program program = load_program(bf_file_path);
+        PassManager pm = create_optimizing_pass_manager();
+        std::vector<BfOp> ops = pm.run(program, false);
+
+        std::vector<uint8_t> input;
+        if (!input_path.empty()) {
+            std::ifstream input_file(input_path, std::ios::binary);
+            if (!input_file) {
+                std::cerr << "Fatal: Unable to open file " << input_path << std::endl;
+                exit(1);
+            }
+            input.assign(std::istreambuf_iterator<char>(input_file), std::istreambuf_iterator<char>());
+        }
+
+        Timer t;
+        Tape tape;
+        MemoryIo io(std::move(input));
+        PairCounter counter(&counts);
+        WITH_CELL_TYPE(cell_width, run_opt3_ops(ops, reinterpret_cast<Cell*>(tape.origin()), io.io(), &counter));
+        std::cerr << "Profiled " << bf_file_path << " (" << t.elapsed() << "s)\n";
+    }
+
+    std::vector<SuperInsn> superinsns;
+    for (size_t a = 0; a < BF_OP_KIND_COUNT; a++) {
+        for (size_t b = 0; b < BF_OP_KIND_COUNT; b++) {
+            BfOpKind first = static_cast<BfOpKind>(a);
+            BfOpKind second = static_cast<BfOpKind>(b);
+            if (counts[a][b] > 0 && is_superinsn_candidate(first, second)) {
+                superinsns.push_back(SuperInsn{first, second, counts[a][b]});
+            }
+        }
+    }
+    std::sort(superinsns.begin(), superinsns.end(),
+            [](const SuperInsn& a, const SuperInsn& b) { return a.count > b.count; });
+    if (superinsns.size() > top) {
+        superinsns.resize(top);
+    }
+
+    std::ofstream out(profile_path);
+    if (!out) {
+        std::cerr << "Fatal: Unable to write " << profile_path << std::endl;
+        exit(1);
+    }
+    write_superinsn_profile(superinsns, out);
+    write_superinsn_profile(superinsns, std::cerr);
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "tape.h"
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// 2 GiB either way of the origin is far more than any int32 offset the JIT
+// emits, so an access can never jump over the reservation.
+constexpr size_t TAPE_RESERVED_SIZE = size_t(1) << 32;
+constexpr size_t TAPE_INITIAL_SIZE = 1 << 16;
+// Tapes of concurrently running programs.
+constexpr size_t MAX_TAPES = 256;
+
+// A tape in use and the number of SIGSEGV handlers looking at it. ~Tape
+// empties the slot and then waits for users to drop to zero, so a fault on
+// one thread never reaches a Tape another thread is destroying.
+struct TapeSlot {
+    std::atomic<Tape*> tape;
+    std::atomic<int> users;
+};
+
+TapeSlot tape_slots[MAX_TAPES];
+struct sigaction previous_segv_action;
+
+void handle_segv(int sig, siginfo_t* info, void* context) {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(info->si_addr);
+    for (size_t i = 0; i < MAX_TAPES; i++) {
+        TapeSlot& slot = tape_slots[i];
+        if (slot.tape.load() == nullptr) {
+            continue;
+        }
+        slot.users.fetch_add(1);
+        Tape* tape = slot.tape.load();
+        bool handled = tape != nullptr && tape->grow(addr);
+        slot.users.fetch_sub(1);
+        if (handled) {
+            return;
+        }
+    }
+
+    // Not a tape access: let the fault happen again under the previous
+    // handler (usually the default, which dumps core).
+    sigaction(SIGSEGV, &previous_segv_action, nullptr);
+}
+
+void install_segv_handler() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = handle_segv;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &previous_segv_action) != 0) {
+        perror("sigaction");
+        exit(1);
+    }
+}
+
+size_t page_size() {
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+uint8_t* page_floor(uint8_t* addr) {
+    return reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(addr) & ~(page_size() - 1));
+}
+
+// Exits from inside the SIGSEGV handler, where stdio is off limits.
+void exit_from_handler(const char* message, size_t size) {
+    ssize_t ignored = write(STDERR_FILENO, message, size);
+    (void)ignored;
+    _exit(1);
+}
+
+Tape::Tape() {
+    static std::once_flag handler_installed;
+    std::call_once(handler_installed, install_segv_handler);
+
+    void* region = mmap(nullptr, TAPE_RESERVED_SIZE, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    reserved_begin_ = static_cast<uint8_t*>(region);
+    reserved_end_ = reserved_begin_ + TAPE_RESERVED_SIZE;
+    origin_ = reserved_begin_ + TAPE_RESERVED_SIZE / 2;
+    committed_begin_ = page_floor(origin_ - TAPE_INITIAL_SIZE / 2);
+    committed_end_ = page_floor(origin_ + TAPE_INITIAL_SIZE / 2 + page_size() - 1);
+    if (mprotect(committed_begin_, committed_end_ - committed_begin_, PROT_READ | PROT_WRITE) != 0) {
+        perror("mprotect");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < MAX_TAPES; i++) {
+        Tape* expected = nullptr;
+        if (tape_slots[i].tape.compare_exchange_strong(expected, this)) {
+            return;
+        }
+    }
+    fprintf(stderr, "Fatal: More than %zu tapes in use\n", MAX_TAPES);
+    exit(1);
+}
+
+Tape::~Tape() {
+    for (size_t i = 0; i < MAX_TAPES; i++) {
+        Tape* expected = this;
+        if (tape_slots[i].tape.compare_exchange_strong(expected, nullptr)) {
+            while (tape_slots[i].users.load() != 0) {
+            }
+            break;
+        }
+    }
+    munmap(reserved_begin_, TAPE_RESERVED_SIZE);
+}
+
+void Tape::clear() {
+    // Private anonymous pages read back as zero after MADV_DONTNEED, without
+    // touching the ones that were never written.
+    if (madvise(committed_begin_, committed_end_ - committed_begin_, MADV_DONTNEED) != 0) {
+        perror("madvise");
+        exit(1);
+    }
+}
+
+bool Tape::grow(uintptr_t addr) {
+    if (addr < reinterpret_cast<uintptr_t>(reserved_begin_) ||
+        addr >= reinterpret_cast<uintptr_t>(reserved_end_)) {
+        return false;
+    }
+
+    uint8_t* fault = page_floor(reinterpret_cast<uint8_t*>(addr));
+    if (fault >= committed_begin_ && fault < committed_end_) {
+        return true;
+    }
+
+    // The first and last page of the reservation always stay guard pages.
+    uint8_t* limit_begin = reserved_begin_ + page_size();
+    uint8_t* limit_end = reserved_end_ - page_size();
+    if (fault < limit_begin || fault >= limit_end) {
+        const char message[] = "Fatal: Data pointer ran off the tape\n";
+        exit_from_handler(message, sizeof(message) - 1);
+    }
+
+    // Double the accessible part towards the fault, or more if the access
+    // skipped further ahead. The committed range only grows once the pages
+    // really are accessible; otherwise the access would fault forever.
+    const char grow_failed[] = "Fatal: Unable to grow the tape\n";
+    size_t size = committed_end_ - committed_begin_;
+    if (fault < committed_begin_) {
+        uint8_t* new_begin = committed_begin_ - std::min<size_t>(size, committed_begin_ - limit_begin);
+        new_begin = std::min(new_begin, fault);
+        if (mprotect(new_begin, committed_begin_ - new_begin, PROT_READ | PROT_WRITE) != 0) {
+            exit_from_handler(grow_failed, sizeof(grow_failed) - 1);
+        }
+        committed_begin_ = new_begin;
+    } else {
+        uint8_t* new_end = committed_end_ + std::min<size_t>(size, limit_end - committed_end_);
+        new_end = std::max(new_end, fault + page_size());
+        if (mprotect(committed_end_, new_end - committed_end_, PROT_READ | PROT_WRITE) != 0) {
+            exit_from_handler(grow_failed, sizeof(grow_failed) - 1);
+        }
+        committed_end_ = new_end;
+    }
+    return true;
+}
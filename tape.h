@@ -0,0 +1,43 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Unbounded BF tape for every executor. A large region is reserved with
+// PROT_NONE and only the pages around the origin start out accessible.
+// Touching any other page of the region faults into a SIGSEGV handler that
+// makes more of it accessible and retries the access, so neither
+// interpreters nor JIT code need bounds checks. Cells start at zero, in
+// both directions from the origin.
+class Tape {
+public:
+    Tape();
+    ~Tape();
+
+    Tape(const Tape&) = delete;
+    Tape& operator=(const Tape&) = delete;
+
+    // Cell 0, where the data pointer starts.
+    uint8_t* origin() const {
+        return origin_;
+    }
+
+    // Zeroes every cell again so the tape can run another program. The
+    // pages stay accessible.
+    void clear();
+
+    // Handles a fault at addr if it is in this tape's reservation. Only
+    // called from the SIGSEGV handler.
+    bool grow(uintptr_t addr);
+
+private:
+    uint8_t* reserved_begin_;
+    uint8_t* reserved_end_;
+    uint8_t* origin_;
+    // Accessible pages are [committed_begin_, committed_end_).
+    uint8_t* committed_begin_;
+    uint8_t* committed_end_;
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include "threaded_interp.h"
+#include "cell.h"
+#include "passes.h"
+#include "scan.h"
+#include "superinsn.h"
+#include "tape.h"
+
+ThreadedInterpreter::ThreadedInterpreter() {}
+
+void ThreadedInterpreter::pre_execute_in_parsing_phase(const Program& p, bool verbose) {
+    PassManager pm = create_optimizing_pass_manager();
+    this->bf_ops = pm.run(p, verbose);
+
+    const ThreadedHandlers* handlers = nullptr;
+    WITH_CELL_TYPE(options.cell_width, handlers = run<Cell>(nullptr, nullptr, nullptr));
+
+    bool fuse[BF_OP_KIND_COUNT][BF_OP_KIND_COUNT] = {};
+    if (!options.superinsn_profile.empty()) {
+        for (auto& s : load_superinsn_profile(options.superinsn_profile)) {
+            fuse[static_cast<size_t>(s.first)][static_cast<size_t>(s.second)] = true;
+        }
+    }
+
+    // One extra slot holds the halt op, so running off the end of the
+    // program needs no bounds check.
+    code.assign(bf_ops.size() + 1, ThreadedOp());
+    size_t fused = 0;
+    for (size_t pc = 0; pc < bf_ops.size(); pc++) {
+        const BfOp& op = bf_ops[pc];
+        ThreadedOp& t = code[pc];
+        size_t kind = static_cast<size_t>(op.kind);
+        t.handler = handlers->ops[kind];
+        t.argument = op.argument;
+        t.offset = op.offset;
+
+        // A fused handler also runs the next slot, which keeps its own
+        // handler for jumps landing on it.
+        if (pc + 1 < bf_ops.size()) {
+            size_t next_kind = static_cast<size_t>(bf_ops[pc + 1].kind);
+            if (fuse[kind][next_kind] && handlers->superinsns[kind][next_kind]) {
+                t.handler = handlers->superinsns[kind][next_kind];
+                fused++;
+            }
+        }
+
+        switch (op.kind) {
+            case BfOpKind::JUMP_IF_DATA_ZERO:
+            case BfOpKind::JUMP_IF_DATA_NOT_ZERO:
+                // Both jumps land just past the matching bracket.
+                t.jump_target = &code[op.argument + 1];
+                break;
+            case BfOpKind::LOOP_MOVE_DATA:
+                t.argument = op.targets.size();
+                t.mul_targets = op.targets.data();
+                break;
+            default:
+                t.jump_target = nullptr;
+                break;
+        }
+    }
+    code.back().handler = handlers->halt;
+    code.back().jump_target = nullptr;
+
+    if (verbose) {
+        std::cout << "Superinstructions: " << fused << " of " << bf_ops.size() << " ops fused\n";
+    }
+}
+
+void ThreadedInterpreter::execute(const Program& p, bool verbose) {
+    Tape tape;
+    StdIo stdio(options.async_io);
+    execute_on(p, tape.origin(), stdio.io());
+}
+
+void ThreadedInterpreter::execute_on(const Program& p, uint8_t* tape, BfIo* io) const {
+    WITH_CELL_TYPE(options.cell_width, run(code.data(), reinterpret_cast<Cell*>(tape), io));
+}
+
+template <typename Cell>
+inline void move_data(Cell* dataptr, const ThreadedOp* op) {
+    Cell* control = dataptr + op->offset;
+    Cell data = *control;
+    for (int64_t i = 0; i < op->argument; i++) {
+        control[op->mul_targets[i].offset] += data * op->mul_targets[i].factor;
+    }
+    *control = 0;
+}
+
+// The handler table is filled by a separate call to run() from the one that
+// dispatches through it, so both have to reach the same copy of the code:
+// label addresses taken in an inlined or cloned copy would point into that
+// copy. GCC may do either to a static function, hence noinline and noclone;
+// Clang never inlines or clones a function whose label addresses escape and
+// has no noclone.
+#if defined(__clang__)
+#define THREADED_RUN_ATTRIBUTES __attribute__((noinline))
+#else
+#define THREADED_RUN_ATTRIBUTES __attribute__((noinline, noclone))
+#endif
+
+template <typename Cell>
+THREADED_RUN_ATTRIBUTES const ThreadedHandlers* ThreadedInterpreter::run(const ThreadedOp* code, Cell* memory,
+                                                                         BfIo* io) {
+    static ThreadedHandlers handlers;
+
+    // BODY_* run an op without touching ip; TAIL_* run it and dispatch the
+    // op that follows it.
+#define BODY_INC_PTR(op) dataptr += (op)->argument;
+#define BODY_DEC_PTR(op) dataptr -= (op)->argument;
+#define BODY_INC_DATA(op) dataptr[(op)->offset] += (op)->argument;
+#define BODY_DEC_DATA(op) dataptr[(op)->offset] -= (op)->argument;
+#define BODY_LOOP_SET_TO_ZERO(op) dataptr[(op)->offset] = 0;
+#define BODY_SET_DATA(op) dataptr[(op)->offset] = (op)->argument;
+#define BODY_LOOP_MOVE_PTR(op) dataptr = scan_for_zero(dataptr, (op)->argument);
+#define BODY_LOOP_MOVE_DATA(op) move_data(dataptr, (op));
+#define BODY_READ_STDIN(op) \
+    for (int64_t i = 0; i < (op)->argument; i++) { \
+        dataptr[(op)->offset] = bf_io_get(io); \
+    }
+#define BODY_WRITE_STDOUT(op) \
+    for (int64_t i = 0; i < (op)->argument; i++) { \
+        bf_io_put(io, dataptr[(op)->offset]); \
+    }
+
+#define DISPATCH() goto *ip->handler
+#define STRAIGHT_TAIL(KIND, op) BODY_##KIND(op) ip = (op) + 1; DISPATCH();
+#define TAIL_INC_PTR(op) STRAIGHT_TAIL(INC_PTR, op)
+#define TAIL_DEC_PTR(op) STRAIGHT_TAIL(DEC_PTR, op)
+#define TAIL_INC_DATA(op) STRAIGHT_TAIL(INC_DATA, op)
+#define TAIL_DEC_DATA(op) STRAIGHT_TAIL(DEC_DATA, op)
+#define TAIL_LOOP_SET_TO_ZERO(op) STRAIGHT_TAIL(LOOP_SET_TO_ZERO, op)
+#define TAIL_SET_DATA(op) STRAIGHT_TAIL(SET_DATA, op)
+#define TAIL_LOOP_MOVE_PTR(op) STRAIGHT_TAIL(LOOP_MOVE_PTR, op)
+#define TAIL_LOOP_MOVE_DATA(op) STRAIGHT_TAIL(LOOP_MOVE_DATA, op)
+#define TAIL_READ_STDIN(op) STRAIGHT_TAIL(READ_STDIN, op)
+#define TAIL_WRITE_STDOUT(op) STRAIGHT_TAIL(WRITE_STDOUT, op)
+// Both jumps land just past the matching bracket.
+#define TAIL_JUMP_IF_DATA_ZERO(op) \
+    ip = *dataptr == 0 ? (op)->jump_target : (op) + 1; \
+    DISPATCH();
+#define TAIL_JUMP_IF_DATA_NOT_ZERO(op) \
+    ip = *dataptr != 0 ? (op)->jump_target : (op) + 1; \
+    DISPATCH();
+
+    if (code == nullptr) {
+        handlers.ops[static_cast<size_t>(BfOpKind::INVALID_OP)] = &&op_invalid;
+        handlers.ops[static_cast<size_t>(BfOpKind::INC_PTR)] = &&op_inc_ptr;
+        handlers.ops[static_cast<size_t>(BfOpKind::DEC_PTR)] = &&op_dec_ptr;
+        handlers.ops[static_cast<size_t>(BfOpKind::INC_DATA)] = &&op_inc_data;
+        handlers.ops[static_cast<size_t>(BfOpKind::DEC_DATA)] = &&op_dec_data;
+        handlers.ops[static_cast<size_t>(BfOpKind::READ_STDIN)] = &&op_read_stdin;
+        handlers.ops[static_cast<size_t>(BfOpKind::WRITE_STDOUT)] = &&op_write_stdout;
+        handlers.ops[static_cast<size_t>(BfOpKind::LOOP_SET_TO_ZERO)] = &&op_loop_set_to_zero;
+        handlers.ops[static_cast<size_t>(BfOpKind::SET_DATA)] = &&op_set_data;
+        handlers.ops[static_cast<size_t>(BfOpKind::LOOP_MOVE_PTR)] = &&op_loop_move_ptr;
+        handlers.ops[static_cast<size_t>(BfOpKind::LOOP_MOVE_DATA)] = &&op_loop_move_data;
+        handlers.ops[static_cast<size_t>(BfOpKind::JUMP_IF_DATA_ZERO)] = &&op_jump_if_data_zero;
+        handlers.ops[static_cast<size_t>(BfOpKind::JUMP_IF_DATA_NOT_ZERO)] = &&op_jump_if_data_not_zero;
+        handlers.halt = &&op_halt;
+
+#define REGISTER_SUPERINSN(A, B) \
+        handlers.superinsns[static_cast<size_t>(BfOpKind::A)][static_cast<size_t>(BfOpKind::B)] = \
+            &&super_##A##_##B;
+#define REGISTER_SUPERINSN_ROW(A) SUPERINSN_SECOND_KINDS(REGISTER_SUPERINSN, A)
+        SUPERINSN_FIRST_KINDS(REGISTER_SUPERINSN_ROW)
+#undef REGISTER_SUPERINSN_ROW
+#undef REGISTER_SUPERINSN
+
+        return &handlers;
+    }
+
+    const ThreadedOp* ip = code;
+    Cell* dataptr = memory;
+
+    DISPATCH();
+
+op_inc_ptr:
+    TAIL_INC_PTR(ip)
+op_dec_ptr:
+    TAIL_DEC_PTR(ip)
+op_inc_data:
+    TAIL_INC_DATA(ip)
+op_dec_data:
+    TAIL_DEC_DATA(ip)
+op_read_stdin:
+    TAIL_READ_STDIN(ip)
+op_write_stdout:
+    TAIL_WRITE_STDOUT(ip)
+op_loop_set_to_zero:
+    TAIL_LOOP_SET_TO_ZERO(ip)
+op_set_data:
+    TAIL_SET_DATA(ip)
+op_loop_move_ptr:
+    TAIL_LOOP_MOVE_PTR(ip)
+op_loop_move_data:
+    TAIL_LOOP_MOVE_DATA(ip)
+op_jump_if_data_zero:
+    TAIL_JUMP_IF_DATA_ZERO(ip)
+op_jump_if_data_not_zero:
+    TAIL_JUMP_IF_DATA_NOT_ZERO(ip)
+
+#define DEFINE_SUPERINSN(A, B) \
+super_##A##_##B: \
+    BODY_##A(ip) \
+    TAIL_##B(ip + 1)
+#define DEFINE_SUPERINSN_ROW(A) SUPERINSN_SECOND_KINDS(DEFINE_SUPERINSN, A)
+    SUPERINSN_FIRST_KINDS(DEFINE_SUPERINSN_ROW)
+#undef DEFINE_SUPERINSN_ROW
+#undef DEFINE_SUPERINSN
+
+op_invalid:
+    std::cerr << "Fatal: Unknown op at pc=" << (ip - code);
+    exit(1);
+op_halt:
+    return &handlers;
+
+#undef TAIL_JUMP_IF_DATA_NOT_ZERO
+#undef TAIL_JUMP_IF_DATA_ZERO
+#undef TAIL_WRITE_STDOUT
+#undef TAIL_READ_STDIN
+#undef TAIL_LOOP_MOVE_DATA
+#undef TAIL_LOOP_MOVE_PTR
+#undef TAIL_SET_DATA
+#undef TAIL_LOOP_SET_TO_ZERO
+#undef TAIL_DEC_DATA
+#undef TAIL_INC_DATA
+#undef TAIL_DEC_PTR
+#undef TAIL_INC_PTR
+#undef STRAIGHT_TAIL
+#undef DISPATCH
+#undef BODY_WRITE_STDOUT
+#undef BODY_READ_STDIN
+#undef BODY_LOOP_MOVE_DATA
+#undef BODY_LOOP_MOVE_PTR
+#undef BODY_SET_DATA
+#undef BODY_LOOP_SET_TO_ZERO
+#undef BODY_DEC_DATA
+#undef BODY_INC_DATA
+#undef BODY_DEC_PTR
+#undef BODY_INC_PTR
+}
@@ -0,0 +1,51 @@
+#ifndef THREADED_INTERP_H
+#define THREADED_INTERP_H
+
+#include "executor.h"
+#include "bf_io.h"
+#include "ir.h"
+#include <vector>
+#include <iostream>
+
+// One pre-decoded op of the direct-threaded code. handler is the address of
+// the label implementing the op, so dispatch is a single indirect jump at the
+// end of every handler.
+struct ThreadedOp {
+    const void* handler = nullptr;
+    int64_t argument = 0;
+    int64_t offset = 0;
+    union {
+        const ThreadedOp* jump_target;
+        const MulTarget* mul_targets;
+    };
+};
+
+struct ThreadedHandlers {
+    const void* ops[BF_OP_KIND_COUNT];
+    const void* halt;
+    // Fused handlers running an op and its successor, for the pairs listed in
+    // superinsn.h; null elsewhere.
+    const void* superinsns[BF_OP_KIND_COUNT][BF_OP_KIND_COUNT];
+};
+
+// Runs the Opt3 IR with computed-goto dispatch (GCC/Clang labels as values).
+// With --superinsns=<profile>, op pairs listed in the profile are fused into
+// a single handler.
+class ThreadedInterpreter : public Executor {
+public:
+    ThreadedInterpreter();
+    void pre_execute_in_parsing_phase(const Program& p, bool verbose) override;
+    void execute(const Program& p, bool verbose) override;
+    void execute_on(const Program& p, uint8_t* tape, BfIo* io) const override;
+
+private:
+    std::vector<BfOp> bf_ops;
+    std::vector<ThreadedOp> code;
+
+    // With code == nullptr, returns the handler addresses without running
+    // anything. Each cell type has its own handlers.
+    template <typename Cell>
+    static const ThreadedHandlers* run(const ThreadedOp* code, Cell* memory, BfIo* io);
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include "tiered_interp.h"
+#include "aot.h"
+#include "cell.h"
+#include "passes.h"
+#include "scan.h"
+#include "tape.h"
+#include "utils.h"
+
+// Entries plus back edges after which a loop is compiled. A loop is
+// compiled in microseconds, so this only keeps code that runs a handful of
+// times from being compiled at all.
+constexpr uint32_t TIERED_JIT_THRESHOLD = 1000;
+
+void TieredInterpreter::pre_execute_in_parsing_phase(const Program& p, bool verbose) {
+    PassManager pm = create_optimizing_pass_manager();
+    this->bf_ops = pm.run(p, verbose);
+    loop_entries.reset(new std::atomic<void*>[bf_ops.size()]());
+    compiled_loops.clear();
+    compiled_loops.resize(bf_ops.size());
+
+    loop_names.assign(bf_ops.size(), std::string());
+    for (size_t pc = 0; pc < bf_ops.size(); pc++) {
+        if (bf_ops[pc].kind == BfOpKind::JUMP_IF_DATA_ZERO) {
+            loop_names[pc] = jit_loop_symbol(p.source_offset(bf_ops[pc].source));
+        }
+    }
+}
+
+void TieredInterpreter::execute(const Program& p, bool verbose) {
+    Tape tape;
+    {
+        StdIo stdio(options.async_io);
+        execute_on(p, tape.origin(), stdio.io());
+    }
+
+    if (verbose) {
+        std::cout << "Compiled " << compiled_loop_count << " loops in " << compile_seconds << "s\n";
+    }
+}
+
+void TieredInterpreter::execute_on(const Program& p, uint8_t* tape, BfIo* io) const {
+    WITH_CELL_TYPE(options.cell_width, run(reinterpret_cast<Cell*>(tape), io));
+}
+
+// Returns the entry of the loop opening at open, compiling it unless
+// another thread got there first.
+void* TieredInterpreter::compile_loop(size_t open) const {
+    std::lock_guard<std::mutex> lock(compile_mutex);
+    if (compiled_loops[open]) {
+        return compiled_loops[open]->program_memory();
+    }
+
+    Timer t;
+    size_t close = bf_ops[open].argument;
+    std::vector<uint8_t> code = compile_bf_ops(bf_ops, open, close + 1, options.cell_width);
+    compiled_loops[open].reset(new JitProgram(code));
+    compiled_loops[open]->publish(options, {JitSymbol{loop_names[open], 0, code.size()}});
+    compiled_loop_count++;
+    compile_seconds += t.elapsed();
+
+    void* entry = compiled_loops[open]->program_memory();
+    loop_entries[open].store(entry, std::memory_order_release);
+    return entry;
+}
+
+template <typename Cell>
+void TieredInterpreter::run(Cell* memory, BfIo* io) const {
+    using CompiledLoop = uint8_t* (*)(uint8_t*, BfIo*);
+
+    size_t pc = 0;
+    int64_t dataptr = 0;
+    std::vector<uint32_t> loop_counters(bf_ops.size(), 0);
+
+    // Returns the compiled entry of the loop opening at open once it is hot,
+    // or nullptr while it should still be interpreted.
+    auto hot_loop = [&](size_t open) -> void* {
+        void* entry = loop_entries[open].load(std::memory_order_acquire);
+        if (entry == nullptr && ++loop_counters[open] >= TIERED_JIT_THRESHOLD) {
+            entry = compile_loop(open);
+        }
+        return entry;
+    };
+
+    // Runs the compiled loop opening at open until it exits, then continues
+    // at its ']' as if it had been interpreted. Entering at the '[' is right
+    // from the back edge too, since the cell is known to be non-zero there.
+    auto run_compiled = [&](size_t open, void* entry) {
+        CompiledLoop loop = reinterpret_cast<CompiledLoop>(entry);
+        uint8_t* end = loop(reinterpret_cast<uint8_t*>(memory + dataptr), io);
+        dataptr = reinterpret_cast<Cell*>(end) - memory;
+        pc = bf_ops[open].argument;
+    };
+
+    while (pc < bf_ops.size()) {
+        const BfOp& op = bf_ops[pc];
+
+        switch (op.kind) {
+            case BfOpKind::INC_PTR:
+                dataptr += op.argument;
+                break;
+            case BfOpKind::DEC_PTR:
+                dataptr -= op.argument;
+                break;
+            case BfOpKind::INC_DATA:
+                memory[dataptr + op.offset] += op.argument;
+                break;
+            case BfOpKind::DEC_DATA:
+                memory[dataptr + op.offset] -= op.argument;
+                break;
+            case BfOpKind::WRITE_STDOUT:
+                for (int64_t i = 0; i < op.argument; i++) {
+                    bf_io_put(io, memory[dataptr + op.offset]);
+                }
+                break;
+            case BfOpKind::READ_STDIN:
+                for (int64_t i = 0; i < op.argument; i++) {
+                    memory[dataptr + op.offset] = bf_io_get(io);
+                }
+                break;
+            case BfOpKind::LOOP_SET_TO_ZERO:
+                memory[dataptr + op.offset] = 0;
+                break;
+            case BfOpKind::SET_DATA:
+                memory[dataptr + op.offset] = op.argument;
+                break;
+            case BfOpKind::LOOP_MOVE_PTR:
+                dataptr = scan_for_zero(&memory[dataptr], op.argument) - memory;
+                break;
+            case BfOpKind::LOOP_MOVE_DATA:
+                {
+                    int64_t control = dataptr + op.offset;
+                    if (memory[control]) {
+                        Cell data = memory[control];
+                        for (auto& t : op.targets) {
+                            memory[control + t.offset] += data * t.factor;
+                        }
+                        memory[control] = 0;
+                    }
+                }
+                break;
+            case BfOpKind::JUMP_IF_DATA_ZERO:
+                if (memory[dataptr] == 0) {
+                    pc = op.argument;
+                } else if (void* entry = hot_loop(pc)) {
+                    run_compiled(pc, entry);
+                }
+                break;
+            case BfOpKind::JUMP_IF_DATA_NOT_ZERO:
+                if (memory[dataptr] != 0) {
+                    size_t open = op.argument;
+                    if (void* entry = hot_loop(open)) {
+                        run_compiled(open, entry);
+                    } else {
+                        pc = open;
+                    }
+                }
+                break;
+            default:
+                std::cerr << "Fatal: Unknown op at pc=" << pc;
+                exit(1);
+                break;
+        }
+        pc++;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef TIERED_INTERP_H
+#define TIERED_INTERP_H
+
+#include "executor.h"
+#include "bf_io.h"
+#include "ir.h"
+#include "jit_utils.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Starts interpreting the optimized IR like Opt3 right away and counts
+// entries and back edges per loop. A loop that reaches
+// TIERED_JIT_THRESHOLD is compiled to machine code on the spot, and from
+// then on every entry into it, including the back edge that made it hot,
+// runs the compiled loop to its end instead of interpreting it.
+//
+// Compiled loops are shared between concurrent execute_on calls; the entry
+// counts are kept per call.
+class TieredInterpreter : public Executor {
+public:
+    TieredInterpreter() {};
+    void pre_execute_in_parsing_phase(const Program& p, bool verbose) override;
+    void execute(const Program& p, bool verbose) override;
+    void execute_on(const Program& p, uint8_t* tape, BfIo* io) const override;
+
+private:
+    template <typename Cell>
+    void run(Cell* memory, BfIo* io) const;
+
+    void* compile_loop(size_t open) const;
+
+    std::vector<BfOp> bf_ops;
+    // Indexed by the pc of a loop's '['. Entries are published once the
+    // code is complete, so readers never take compile_mutex.
+    std::unique_ptr<std::atomic<void*>[]> loop_entries;
+    mutable std::vector<std::unique_ptr<JitProgram>> compiled_loops;
+    mutable std::mutex compile_mutex;
+    // Symbols of the compiled loops, for --perf-map and friends.
+    std::vector<std::string> loop_names;
+
+    mutable size_t compiled_loop_count = 0;
+    mutable double compile_seconds = 0;
+};
+
+#endif
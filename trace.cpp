@@ -0,0 +1,109 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// 64 MiB of events; the file is sparse until the ring fills up.
+constexpr uint64_t TRACE_RING_EVENTS = uint64_t(1) << 22;
+
+std::atomic<int> trace_files_opened{0};
+
+TraceWriter::TraceWriter(const std::string& path, const std::vector<BfOp>& ops) {
+    int sequence = trace_files_opened++;
+    std::string file_path = sequence == 0 ? path : path + "." + std::to_string(sequence);
+
+    size_t target_count = 0;
+    for (auto& op : ops) {
+        target_count += op.targets.size();
+    }
+    mapping_size_ = sizeof(TraceHeader) + ops.size() * sizeof(TraceOp) + target_count * sizeof(TraceTarget) +
+                    ops.size() * sizeof(uint64_t) + TRACE_RING_EVENTS * sizeof(TraceEvent);
+
+    int fd = open(file_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, mapping_size_) != 0) {
+        perror(file_path.c_str());
+        exit(1);
+    }
+    mapping_ = mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping_ == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+
+    header_ = static_cast<TraceHeader*>(mapping_);
+    memcpy(header_->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header_->op_count = ops.size();
+    header_->target_count = target_count;
+    header_->capacity = TRACE_RING_EVENTS;
+    header_->written = 0;
+
+    TraceOp* trace_ops = reinterpret_cast<TraceOp*>(header_ + 1);
+    TraceTarget* targets = reinterpret_cast<TraceTarget*>(trace_ops + ops.size());
+    uint32_t target_begin = 0;
+    for (size_t i = 0; i < ops.size(); i++) {
+        uint32_t count = ops[i].targets.size();
+        trace_ops[i] = TraceOp{static_cast<uint32_t>(ops[i].kind), static_cast<int32_t>(ops[i].offset),
+                               ops[i].argument, target_begin, count};
+        for (auto& t : ops[i].targets) {
+            targets[target_begin++] = TraceTarget{t.offset, t.factor};
+        }
+    }
+    // ftruncate zero-fills, so the counts start at zero.
+    counts_ = reinterpret_cast<uint64_t*>(targets + target_count);
+    events_ = reinterpret_cast<TraceEvent*>(counts_ + ops.size());
+    mask_ = TRACE_RING_EVENTS - 1;
+}
+
+TraceWriter::~TraceWriter() {
+    munmap(mapping_, mapping_size_);
+}
+
+Trace read_trace(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        perror(path.c_str());
+        exit(1);
+    }
+    Trace trace;
+    TraceHeader& header = trace.header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+        header.capacity == 0 || (header.capacity & (header.capacity - 1)) != 0) {
+        std::cerr << "Fatal: " << path << " is not a trace file" << std::endl;
+        exit(1);
+    }
+
+    trace.ops.resize(header.op_count);
+    trace.targets.resize(header.target_count);
+    trace.counts.resize(header.op_count);
+    std::vector<TraceEvent> ring(header.capacity);
+    if (fread(trace.ops.data(), sizeof(TraceOp), trace.ops.size(), file) != trace.ops.size() ||
+        fread(trace.targets.data(), sizeof(TraceTarget), trace.targets.size(), file) != trace.targets.size() ||
+        fread(trace.counts.data(), sizeof(uint64_t), trace.counts.size(), file) != trace.counts.size() ||
+        fread(ring.data(), sizeof(TraceEvent), ring.size(), file) != ring.size()) {
+        std::cerr << "Fatal: " << path << " is truncated" << std::endl;
+        exit(1);
+    }
+    fclose(file);
+
+    for (auto& op : trace.ops) {
+        if (op.target_begin + uint64_t(op.target_count) > trace.targets.size()) {
+            std::cerr << "Fatal: " << path << " has ops with targets outside the file" << std::endl;
+            exit(1);
+        }
+    }
+
+    uint64_t retained = std::min(header.written, header.capacity);
+    trace.events.reserve(retained);
+    for (uint64_t n = header.written - retained; n < header.written; n++) {
+        trace.events.push_back(ring[n & (header.capacity - 1)]);
+    }
+    return trace;
+}
@@ -0,0 +1,100 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "ir.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary execution trace (--trace=<file>). The Opt2 and Opt3 interpreters
+// count every executed op and record one fixed-size event for it into a
+// ring buffer, both in an mmapped file, so recording is a couple of stores
+// and whatever was recorded survives a crash. bf_trace turns a trace into
+// op frequencies (from the counts, exact for the whole run) and loop body
+// histograms (from the events the ring still holds) offline.
+//
+// File layout: TraceHeader, then op_count TraceOps (the IR being run),
+// target_count TraceTargets (the targets of its LOOP_MOVE_DATA ops),
+// op_count uint64_t execution counts, one per op, then a ring of capacity
+// TraceEvents holding the last events written.
+
+constexpr char TRACE_MAGIC[8] = {'B', 'F', 'T', 'R', 'A', 'C', 'E', '3'};
+
+struct TraceHeader {
+    char magic[8];
+    uint64_t op_count;
+    uint64_t target_count;
+    // A power of two.
+    uint64_t capacity;
+    // Events ever recorded; event n is at ring index n % capacity.
+    uint64_t written;
+};
+
+struct TraceOp {
+    uint32_t kind;
+    int32_t offset;
+    int64_t argument;
+    // Targets [target_begin, target_begin + target_count) belong to this op.
+    uint32_t target_begin;
+    uint32_t target_count;
+};
+
+struct TraceTarget {
+    int64_t offset;
+    int64_t factor;
+};
+
+struct TraceEvent {
+    uint32_t pc;
+    uint32_t kind;
+    int64_t dataptr;
+};
+
+// Stands in for TraceWriter when tracing is off, so untraced runs compile
+// to the same code as before.
+struct NoTrace {
+    void record(size_t pc, BfOpKind kind, int64_t dataptr) {}
+};
+
+// One traced run. Concurrent runs (--batch) each get their own file: the
+// first one path, the next path.1, path.2 and so on.
+class TraceWriter {
+public:
+    TraceWriter(const std::string& path, const std::vector<BfOp>& ops);
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    void record(size_t pc, BfOpKind kind, int64_t dataptr) {
+        uint64_t n = header_->written;
+        events_[n & mask_] = TraceEvent{static_cast<uint32_t>(pc), static_cast<uint32_t>(kind), dataptr};
+        header_->written = n + 1;
+        counts_[pc]++;
+    }
+
+private:
+    void* mapping_;
+    size_t mapping_size_;
+    TraceHeader* header_;
+    uint64_t* counts_;
+    TraceEvent* events_;
+    uint64_t mask_;
+};
+
+// A trace file as read back, with the retained events oldest first.
+struct Trace {
+    TraceHeader header;
+    std::vector<TraceOp> ops;
+    std::vector<TraceTarget> targets;
+    // Times each op ran.
+    std::vector<uint64_t> counts;
+    std::vector<TraceEvent> events;
+};
+
+// Exits on errors.
+Trace read_trace(const std::string& path);
+
+#endif
@@ -0,0 +1,129 @@
+// bf_trace: summarizes a trace written with --trace=<file>: how often each
+// op kind and each op ran over the whole run, and the most frequent
+// straight-line sequences between two brackets (loop bodies, mostly) among
+// the events still in the trace's ring.
+//
+// Usage: bf_trace [--top=N] <trace-file>
+
+#include "trace.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <unordered_map>
+
+// Kind, argument and offset of an op, e.g. "+3@5", and the targets of a
+// LOOP_MOVE_DATA as offset:factor pairs, e.g. "LOOP_MOVE_DATA(1:2,-1:1)".
+std::string op_token(const TraceOp& op, const std::vector<TraceTarget>& targets) {
+    BfOpKind kind = static_cast<BfOpKind>(op.kind);
+    std::string token = get_kind_char(kind);
+    if (token == "?") {
+        token = get_kind_str(kind);
+    }
+    if (kind != BfOpKind::LOOP_SET_TO_ZERO && kind != BfOpKind::LOOP_MOVE_DATA) {
+        token += std::to_string(op.argument);
+    }
+    if (op.offset != 0) {
+        token += "@" + std::to_string(op.offset);
+    }
+    if (kind == BfOpKind::LOOP_MOVE_DATA) {
+        token += "(";
+        for (uint32_t i = 0; i < op.target_count; i++) {
+            const TraceTarget& t = targets[op.target_begin + i];
+            token += (i > 0 ? "," : "") + std::to_string(t.offset) + ":" + std::to_string(t.factor);
+        }
+        token += ")";
+    }
+    return token;
+}
+
+template <typename Key>
+std::vector<std::pair<Key, uint64_t>> ranked(const std::unordered_map<Key, uint64_t>& counts) {
+    std::vector<std::pair<Key, uint64_t>> result(counts.begin(), counts.end());
+    std::sort(result.begin(), result.end(),
+            [](const std::pair<Key, uint64_t>& a, const std::pair<Key, uint64_t>& b) {
+                return a.second > b.second;
+            });
+    return result;
+}
+
+int main(int argc, const char** argv) {
+    size_t top = 20;
+    int arg_i = 1;
+    std::string value;
+    for (; arg_i < argc && std::string(argv[arg_i]).compare(0, 2, "--") == 0; arg_i++) {
+        std::string arg = argv[arg_i];
+        if (match_flag_value(arg, "--top", &value)) {
+            top = std::atoi(value.c_str());
+        } else {
+            std::cerr << "Unknown flag " << arg << std::endl;
+            exit(1);
+        }
+    }
+    if (argc - arg_i != 1) {
+        std::cerr << "Usage: " << argv[0] << " [--top=N] <trace-file>\n";
+        exit(1);
+    }
+
+    Trace trace = read_trace(argv[arg_i]);
+    const TraceHeader& header = trace.header;
+    const std::vector<TraceOp>& ops = trace.ops;
+    const std::vector<TraceEvent>& events = trace.events;
+
+    std::unordered_map<uint32_t, uint64_t> kind_count;
+    std::unordered_map<uint32_t, uint64_t> pc_count;
+    uint64_t total = 0;
+    for (size_t pc = 0; pc < ops.size(); pc++) {
+        if (trace.counts[pc] > 0) {
+            kind_count[ops[pc].kind] += trace.counts[pc];
+            pc_count[pc] = trace.counts[pc];
+            total += trace.counts[pc];
+        }
+    }
+
+    std::unordered_map<std::string, uint64_t> sequence_count;
+    std::string sequence;
+    for (auto& e : events) {
+        if (e.pc >= ops.size()) {
+            std::cerr << "Fatal: Event for pc=" << e.pc << " outside the program" << std::endl;
+            exit(1);
+        }
+        BfOpKind kind = static_cast<BfOpKind>(e.kind);
+        if (kind == BfOpKind::JUMP_IF_DATA_ZERO) {
+            sequence.clear();
+        } else if (kind == BfOpKind::JUMP_IF_DATA_NOT_ZERO) {
+            sequence_count[sequence]++;
+            sequence.clear();
+        } else {
+            if (!sequence.empty()) {
+                sequence += ' ';
+            }
+            sequence += op_token(ops[e.pc], trace.targets);
+        }
+    }
+
+    std::cout << "Events: " << header.written << " recorded, " << events.size() << " in the ring\n";
+
+    std::cout << "\n* Op kinds:\n";
+    for (auto& k : ranked(kind_count)) {
+        std::cout << std::setw(24) << std::left << get_kind_str(static_cast<BfOpKind>(k.first))
+                  << std::setw(14) << std::right << k.second << std::setw(8) << std::fixed
+                  << std::setprecision(1) << 100.0 * k.second / total << "%\n";
+    }
+
+    std::cout << "\n* Hottest ops:\n";
+    auto pcs = ranked(pc_count);
+    for (size_t i = 0; i < pcs.size() && i < top; i++) {
+        const TraceOp& op = ops[pcs[i].first];
+        std::cout << "pc=" << std::setw(8) << std::left << pcs[i].first << std::setw(32)
+                  << op_token(op, trace.targets) << std::setw(14) << std::right << pcs[i].second << "\n";
+    }
+
+    std::cout << "\n* Sequences between brackets, in the last " << events.size() << " events:\n";
+    auto sequences = ranked(sequence_count);
+    for (size_t i = 0; i < sequences.size() && i < top; i++) {
+        std::cout << std::setw(15) << std::left << sequences[i].first << " --> " << sequences[i].second << "\n";
+    }
+    return 0;
+}
@@ -10,9 +10,19 @@ double Timer::elapsed() {
     return elapsed.count();
 }
 
-void parse_command_line(int argc, const char** argv, std::string* bf_file_path, bool* verbose) {
-    *verbose = false;
+// Matches "<name>=<value>" flags such as --superinsns=profile.txt.
+bool match_flag_value(const std::string& arg, const std::string& name, std::string* value) {
+    if (arg.size() <= name.size() || arg.compare(0, name.size(), name) != 0 || arg[name.size()] != '=') {
+        return false;
+    }
+    *value = arg.substr(name.size() + 1);
+    return true;
+}
+
+void parse_command_line(int argc, const char** argv, std::string* bf_file_path, Options* options) {
+    *options = Options();
 
+    std::string value;
     int arg_i = 1;
     for (; arg_i < argc; ++arg_i) {
         std::string arg = argv[arg_i];
@@ -20,7 +30,54 @@ void parse_command_line(int argc, const char** argv, std::string* bf_file_path,
             // If this arg doesn't start with a --, it's not a flag.
             break;
         } else if (arg == "--verbose"){
-            *verbose = true;
+            options->verbose = true;
+        } else if (arg == "--async-io") {
+            options->async_io = true;
+        } else if (arg == "--loop-profile") {
+            options->loop_profile = true;
+        } else if (arg == "--perf-map") {
+            options->perf_map = true;
+        } else if (arg == "--jitdump") {
+            options->jitdump = true;
+        } else if (arg == "--gdb-jit") {
+            options->gdb_jit = true;
+        } else if (arg == "--perf-counters") {
+            options->perf_counters = true;
+        } else if (arg == "--partial-eval") {
+            options->partial_eval_steps = DEFAULT_PARTIAL_EVAL_STEPS;
+        } else if (match_flag_value(arg, "--partial-eval", &value)) {
+            long long steps = std::atoll(value.c_str());
+            if (steps <= 0) {
+                std::cerr << "Fatal: --partial-eval must be a positive number of steps" << std::endl;
+                exit(1);
+            }
+            options->partial_eval_steps = steps;
+        } else if (arg == "--batch") {
+            options->batch = true;
+        } else if (match_flag_value(arg, "--jobs", &value)) {
+            int jobs = std::atoi(value.c_str());
+            if (jobs <= 0) {
+                std::cerr << "Fatal: --jobs must be a positive number" << std::endl;
+                exit(1);
+            }
+            options->batch_jobs = jobs;
+        } else if (match_flag_value(arg, "--compile-jobs", &value)) {
+            int jobs = std::atoi(value.c_str());
+            if (jobs <= 0) {
+                std::cerr << "Fatal: --compile-jobs must be a positive number" << std::endl;
+                exit(1);
+            }
+            options->compile_jobs = jobs;
+        } else if (match_flag_value(arg, "--superinsns", &options->superinsn_profile)) {
+        } else if (match_flag_value(arg, "--code-cache", &options->code_cache_dir)) {
+        } else if (match_flag_value(arg, "--trace", &options->trace_path)) {
+        } else if (match_flag_value(arg, "--cell-width", &value)) {
+            options->cell_width = std::atoi(value.c_str());
+            if (options->cell_width != 8 && options->cell_width != 16 &&
+                options->cell_width != 32 && options->cell_width != 64) {
+                std::cerr << "Fatal: --cell-width must be 8, 16, 32 or 64" << std::endl;
+                exit(1);
+            }
         } else {
             exit(1);
         }
@@ -31,4 +88,18 @@ void parse_command_line(int argc, const char** argv, std::string* bf_file_path,
         exit(1);
     }
     *bf_file_path = argv[arg_i];
+
+    if (options->batch) {
+        options->batch_inputs.assign(argv + arg_i + 1, argv + argc);
+        if (options->batch_inputs.empty()) {
+            std::cout << "You must specify input files for --batch" << std::endl;
+            exit(1);
+        }
+        // The workers would all bump one set of counters without
+        // synchronization, and only execute() prints the report.
+        if (options->loop_profile) {
+            std::cerr << "Fatal: --loop-profile can't be combined with --batch" << std::endl;
+            exit(1);
+        }
+    }
 }
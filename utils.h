@@ -1,3 +1,9 @@
+#ifndef UTILS_H
+#define UTILS_H
+
+#include "executor.h"
+#include "options.h"
+
 #include <chrono>
 #include <string>
 
@@ -11,4 +17,8 @@ private:
     std::chrono::time_point<std::chrono::high_resolution_clock> t1_;
 };
 
-void parse_command_line(int argc, const char** argv, std::string* bf_file_path, bool* verbose);
+bool match_flag_value(const std::string& arg, const std::string& name, std::string* value);
+
+void parse_command_line(int argc, const char** argv, std::string* bf_file_path, Options* options);
+
+#endif